@@ -0,0 +1,483 @@
+#include "HIDReportRecorder.h"
+#include <string.h>
+
+using namespace arduino;
+
+/*
+ * Record layout, all multi-byte values little endian:
+ *
+ *   tag      bits 7-6 kind, bit 5 set for OUT reports
+ *   dt       LEB128 varint, microseconds since the previous record
+ *   id       report ID (data[0])
+ *
+ *   KEY      length byte (including the ID), then length - 1 payload bytes
+ *   DELTA    runs of [skip << 4 | count] followed by count bytes, 0x00 terminates.
+ *            Offsets start at data[1] and are relative to the previous report
+ *            with the same direction and ID.
+ *   REPEAT   u16 count. The previous report with the same direction and ID is
+ *            repeated count times, dt apart.
+ */
+#define RECORD_KEY 0x00
+#define RECORD_DELTA 0x40
+#define RECORD_REPEAT 0x80
+#define RECORD_KIND_MASK 0xC0
+#define RECORD_OUT 0x20
+
+// tag + varint + id + length/terminator + worst case delta (one header per byte)
+#define RECORD_MAX_SIZE (8 + 2 * HID_CAPTURE_MAX_REPORT)
+
+static uint32_t put_varint(uint8_t *dst, uint32_t value) {
+    uint32_t n = 0;
+    while (value >= 0x80) {
+        dst[n++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    dst[n++] = (uint8_t) value;
+    return n;
+}
+
+static void put_u32(uint8_t *dst, uint32_t value) {
+    dst[0] = value & 0xff;
+    dst[1] = (value >> 8) & 0xff;
+    dst[2] = (value >> 16) & 0xff;
+    dst[3] = (value >> 24) & 0xff;
+}
+
+static uint32_t get_u32(const uint8_t *src) {
+    return src[0] | (src[1] << 8) | ((uint32_t) src[2] << 16) | ((uint32_t) src[3] << 24);
+}
+
+HIDReportRecorder::HIDReportRecorder(uint8_t *buffer, uint32_t size) :
+        _buffer(buffer), _size(size), _jitter(HID_CAPTURE_REPEAT_JITTER) {
+    clear();
+}
+
+void HIDReportRecorder::clear() {
+    _head = 0;
+    _tail = 0;
+    _used = 0;
+    _base_time = 0;
+    _last_time = 0;
+    _empty = true;
+    _recorded = 0;
+    _evicted = 0;
+    _repeat_open = false;
+    memset(_slots, 0, sizeof(_slots));
+}
+
+void HIDReportRecorder::set_repeat_jitter(uint32_t jitter_us) {
+    _jitter = jitter_us;
+}
+
+HIDReportRecorder::Slot *HIDReportRecorder::_slot(bool out, uint8_t id) {
+    for (int i = 0; i < HID_CAPTURE_SLOTS; i++) {
+        if (_slots[i].valid && _slots[i].out == out && _slots[i].id == id) {
+            return &_slots[i];
+        }
+    }
+    for (int i = 0; i < HID_CAPTURE_SLOTS; i++) {
+        if (!_slots[i].valid) {
+            _slots[i].out = out;
+            _slots[i].id = id;
+            _slots[i].length = 0;
+            return &_slots[i];
+        }
+    }
+    // Out of slots, such reports are always stored as keyframes
+    return nullptr;
+}
+
+void HIDReportRecorder::record(uint32_t timestamp, bool out, const uint8_t *data, uint32_t length) {
+    if (length == 0 || length > HID_CAPTURE_MAX_REPORT) {
+        return;
+    }
+    uint8_t id = data[0];
+    Slot *slot = _slot(out, id);
+    bool same = slot && slot->valid && slot->length == length && memcmp(slot->data, data, length) == 0;
+
+    _recorded++;
+    if (same && _extend_repeat(timestamp, out, id)) {
+        return;
+    }
+
+    if (_empty) {
+        _base_time = timestamp;
+        _last_time = timestamp;
+        _empty = false;
+    }
+    uint32_t dt = timestamp - _last_time;
+    _last_time = timestamp;
+
+    uint8_t buf[RECORD_MAX_SIZE];
+    uint8_t tag = out ? RECORD_OUT : 0;
+    uint32_t n = 1;
+    n += put_varint(&buf[n], dt);
+    buf[n++] = id;
+
+    if (same) {
+        buf[0] = tag | RECORD_REPEAT;
+        buf[n++] = 1;
+        buf[n++] = 0;
+        uint32_t start = _head;
+        _append(buf, n);
+        _repeat_open = true;
+        _repeat_out = out;
+        _repeat_id = id;
+        _repeat_pos = (start + n - 2) % _size;
+        _repeat_interval = dt;
+        _repeat_count = 1;
+        return;
+    }
+
+    bool key = !slot || !slot->valid || slot->length != length ||
+               slot->since_keyframe >= HID_CAPTURE_KEYFRAME_INTERVAL;
+    if (!key) {
+        uint32_t delta = n;
+        uint32_t i = 1;
+        while (true) {
+            uint32_t skip = 0;
+            while (i < length && data[i] == slot->data[i]) {
+                i++;
+                skip++;
+            }
+            if (i >= length) {
+                break;
+            }
+            while (skip > 15) {
+                buf[delta++] = 0xF0;
+                skip -= 15;
+            }
+            uint32_t start = i;
+            uint32_t count = 0;
+            while (i < length && data[i] != slot->data[i] && count < 15) {
+                i++;
+                count++;
+            }
+            buf[delta++] = (uint8_t) (skip << 4 | count);
+            memcpy(&buf[delta], &data[start], count);
+            delta += count;
+        }
+        buf[delta++] = 0;
+        // A delta that is no smaller than the full report is not worth it
+        if (delta - n < length) {
+            buf[0] = tag | RECORD_DELTA;
+            n = delta;
+            slot->since_keyframe++;
+        } else {
+            key = true;
+        }
+    }
+    if (key) {
+        buf[0] = tag | RECORD_KEY;
+        buf[n++] = (uint8_t) length;
+        memcpy(&buf[n], &data[1], length - 1);
+        n += length - 1;
+        if (slot) {
+            slot->since_keyframe = 0;
+        }
+    }
+
+    _repeat_open = false;
+    _append(buf, n);
+
+    if (slot) {
+        slot->valid = true;
+        slot->length = (uint8_t) length;
+        memcpy(slot->data, data, length);
+    }
+}
+
+bool HIDReportRecorder::_extend_repeat(uint32_t timestamp, bool out, uint8_t id) {
+    if (!_repeat_open || _repeat_out != out || _repeat_id != id || _repeat_count == 0xFFFF) {
+        return false;
+    }
+    // Early or late by up to the jitter, but never more than a quarter interval so a
+    // changed rate still starts a new record
+    uint32_t expected = _last_time + _repeat_interval;
+    int32_t late = (int32_t) (timestamp - expected);
+    uint32_t tolerance = _jitter < _repeat_interval / 4 ? _jitter : _repeat_interval / 4;
+    if ((uint32_t) (late < 0 ? -late : late) > tolerance) {
+        return false;
+    }
+    _repeat_count++;
+    _buffer[_repeat_pos] = _repeat_count & 0xff;
+    _buffer[(_repeat_pos + 1) % _size] = _repeat_count >> 8;
+    _last_time = expected;
+    return true;
+}
+
+void HIDReportRecorder::_append(const uint8_t *record, uint32_t length) {
+    if (length > _size) {
+        return;
+    }
+    while (_size - _used < length) {
+        _evict();
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        _buffer[_head] = record[i];
+        _head = (_head + 1) % _size;
+    }
+    _used += length;
+}
+
+uint8_t HIDReportRecorder::_peek(uint32_t offset) const {
+    return _buffer[(_tail + offset) % _size];
+}
+
+void HIDReportRecorder::_evict() {
+    uint8_t tag = _peek(0);
+    uint32_t n = 1;
+    uint32_t dt = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t b = _peek(n++);
+        dt |= (uint32_t) (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+    n++; // report ID
+
+    switch (tag & RECORD_KIND_MASK) {
+        case RECORD_KEY:
+            n += _peek(n);
+            _base_time += dt;
+            break;
+        case RECORD_DELTA:
+            while (true) {
+                uint8_t run = _peek(n++);
+                if (run == 0) {
+                    break;
+                }
+                n += run & 0x0f;
+            }
+            _base_time += dt;
+            break;
+        default:
+            _base_time += dt * (_peek(n) | (_peek(n + 1) << 8));
+            n += 2;
+            break;
+    }
+
+    // The open repeat is always the newest record, so it only goes away with everything else
+    if (n >= _used) {
+        _repeat_open = false;
+        n = _used;
+    }
+    _tail = (_tail + n) % _size;
+    _used -= n;
+    _evicted++;
+}
+
+uint32_t HIDReportRecorder::capture_size() const {
+    return HID_CAPTURE_HEADER_SIZE + _used;
+}
+
+uint32_t HIDReportRecorder::export_capture(uint8_t *dst, uint32_t max) const {
+    uint32_t size = capture_size();
+    if (max < size) {
+        return 0;
+    }
+    dst[0] = 'H';
+    dst[1] = 'I';
+    dst[2] = 'D';
+    dst[3] = 'C';
+    dst[4] = HID_CAPTURE_VERSION;
+    dst[5] = 0;
+    dst[6] = 0;
+    dst[7] = 0;
+    put_u32(&dst[8], _base_time);
+    put_u32(&dst[12], _used);
+    for (uint32_t i = 0; i < _used; i++) {
+        dst[HID_CAPTURE_HEADER_SIZE + i] = _peek(i);
+    }
+    return size;
+}
+
+uint32_t HIDReportRecorder::used() const {
+    return _used;
+}
+
+uint32_t HIDReportRecorder::recorded() const {
+    return _recorded;
+}
+
+uint32_t HIDReportRecorder::evicted() const {
+    return _evicted;
+}
+
+HIDReportReplayer::HIDReportReplayer() : _data(nullptr), _size(0), _base_time(0) {
+    rewind();
+}
+
+bool HIDReportReplayer::open(const uint8_t *capture, uint32_t size) {
+    _data = nullptr;
+    _size = 0;
+    if (size < HID_CAPTURE_HEADER_SIZE || memcmp(capture, "HIDC", 4) != 0 ||
+        capture[4] != HID_CAPTURE_VERSION) {
+        return false;
+    }
+    uint32_t length = get_u32(&capture[12]);
+    if (length > size - HID_CAPTURE_HEADER_SIZE) {
+        return false;
+    }
+    _data = &capture[HID_CAPTURE_HEADER_SIZE];
+    _size = length;
+    _base_time = get_u32(&capture[8]);
+    rewind();
+    return true;
+}
+
+void HIDReportReplayer::rewind() {
+    _pos = 0;
+    _time = _base_time;
+    _skipped = 0;
+    _repeat_left = 0;
+    _repeat_slot = nullptr;
+    memset(_slots, 0, sizeof(_slots));
+}
+
+uint32_t HIDReportReplayer::skipped() const {
+    return _skipped;
+}
+
+HIDReportReplayer::Slot *HIDReportReplayer::_slot(bool out, uint8_t id, bool claim) {
+    for (int i = 0; i < HID_CAPTURE_SLOTS; i++) {
+        if (_slots[i].valid && _slots[i].out == out && _slots[i].id == id) {
+            return &_slots[i];
+        }
+    }
+    if (!claim) {
+        return nullptr;
+    }
+    for (int i = 0; i < HID_CAPTURE_SLOTS; i++) {
+        if (!_slots[i].valid) {
+            _slots[i].out = out;
+            _slots[i].id = id;
+            return &_slots[i];
+        }
+    }
+    return nullptr;
+}
+
+bool HIDReportReplayer::_read_varint(uint32_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (_pos >= _size) {
+            return false;
+        }
+        uint8_t b = _data[_pos++];
+        *value |= (uint32_t) (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HIDReportReplayer::_apply_runs(uint8_t *dst, uint32_t length) {
+    uint32_t offset = 1;
+    while (true) {
+        if (_pos >= _size) {
+            return false;
+        }
+        uint8_t run = _data[_pos++];
+        if (run == 0) {
+            return true;
+        }
+        uint32_t count = run & 0x0f;
+        offset += run >> 4;
+        if (offset + count > length || _pos + count > _size) {
+            return false;
+        }
+        if (dst) {
+            memcpy(&dst[offset], &_data[_pos], count);
+        }
+        offset += count;
+        _pos += count;
+    }
+}
+
+bool HIDReportReplayer::next(HIDCaptureEntry *entry) {
+    Slot *slot = _repeat_slot;
+
+    if (_repeat_left == 0) {
+        while (true) {
+            if (_pos >= _size) {
+                return false;
+            }
+            uint8_t tag = _data[_pos++];
+            uint32_t dt;
+            if (!_read_varint(&dt) || _pos >= _size) {
+                return false;
+            }
+            bool out = (tag & RECORD_OUT) != 0;
+            uint8_t id = _data[_pos++];
+
+            if ((tag & RECORD_KIND_MASK) == RECORD_KEY) {
+                if (_pos >= _size) {
+                    return false;
+                }
+                uint8_t length = _data[_pos++];
+                if (length == 0 || length > HID_CAPTURE_MAX_REPORT || _pos + length - 1 > _size) {
+                    return false;
+                }
+                _time += dt;
+                entry->timestamp = _time;
+                entry->out = out;
+                entry->length = length;
+                entry->data[0] = id;
+                memcpy(&entry->data[1], &_data[_pos], length - 1);
+                _pos += length - 1;
+
+                slot = _slot(out, id, true);
+                if (slot) {
+                    slot->valid = true;
+                    slot->length = length;
+                    memcpy(slot->data, entry->data, length);
+                }
+                return true;
+            }
+
+            slot = _slot(out, id, false);
+            if ((tag & RECORD_KIND_MASK) == RECORD_DELTA) {
+                _time += dt;
+                if (!_apply_runs(slot ? slot->data : nullptr, slot ? slot->length : HID_CAPTURE_MAX_REPORT)) {
+                    return false;
+                }
+                if (!slot) {
+                    _skipped++;
+                    continue;
+                }
+                break;
+            }
+
+            if (_pos + 2 > _size) {
+                return false;
+            }
+            uint16_t count = _data[_pos] | (_data[_pos + 1] << 8);
+            _pos += 2;
+            if (!slot) {
+                _time += dt * count;
+                _skipped += count;
+                continue;
+            }
+            if (count == 0) {
+                continue;
+            }
+            _repeat_slot = slot;
+            _repeat_interval = dt;
+            _repeat_left = count;
+            break;
+        }
+    }
+
+    if (_repeat_left > 0) {
+        _repeat_left--;
+        _time += _repeat_interval;
+    }
+    entry->timestamp = _time;
+    entry->out = slot->out;
+    entry->length = slot->length;
+    memcpy(entry->data, slot->data, slot->length);
+    return true;
+}
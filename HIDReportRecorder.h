@@ -0,0 +1,171 @@
+#ifndef HIDREPORTRECORDER_H
+#define HIDREPORTRECORDER_H
+
+#include <stdint.h>
+
+// Kept free of mbed/Arduino headers so the same code decodes captures on the host.
+#define HID_CAPTURE_MAX_REPORT 64
+#define HID_CAPTURE_SLOTS 10
+#define HID_CAPTURE_KEYFRAME_INTERVAL 64
+#define HID_CAPTURE_HEADER_SIZE 16
+#define HID_CAPTURE_VERSION 1
+#define HID_CAPTURE_REPEAT_JITTER 100 // us, micros() after a blocking send is off by a few us
+
+namespace arduino {
+
+    /* One decoded report. data[0] is the report ID, as in HID_REPORT. */
+    struct HIDCaptureEntry {
+        uint32_t timestamp;     /*!< microseconds */
+        bool out;               /*!< true for host to device (OUT) reports */
+        uint32_t length;
+        uint8_t data[HID_CAPTURE_MAX_REPORT];
+    };
+
+    /**
+    * Records HID reports into a caller supplied ring buffer.
+    *
+    * Each report is stored as a delta against the previous report with the same
+    * direction and report ID, and runs of identical reports at a steady interval
+    * collapse into a single repeat record. A keyframe is forced every
+    * HID_CAPTURE_KEYFRAME_INTERVAL reports per ID so decoding can resume once the
+    * oldest records have been overwritten.
+    *
+    * Not reentrant; callers recording from both thread and interrupt context
+    * must serialize calls to record().
+    */
+    class HIDReportRecorder {
+    public:
+        HIDReportRecorder(uint8_t *buffer, uint32_t size);
+
+        void record(uint32_t timestamp, bool out, const uint8_t *data, uint32_t length);
+
+        void clear();
+
+        /*
+        * Repeats of an identical report are merged while each one arrives within the given
+        * jitter of the nominal interval, capped at a quarter of the interval. Repeat timestamps
+        * are then reconstructed at the nominal interval. Defaults to HID_CAPTURE_REPEAT_JITTER,
+        * 0 requires exact spacing.
+        */
+        void set_repeat_jitter(uint32_t jitter_us);
+
+        /**
+        * Write a self-contained capture (header + records, oldest first) to dst.
+        *
+        * @returns number of bytes written, 0 if dst is too small
+        */
+        uint32_t export_capture(uint8_t *dst, uint32_t max) const;
+
+        uint32_t capture_size() const;
+
+        uint32_t used() const;
+
+        uint32_t recorded() const;
+
+        uint32_t evicted() const;
+
+    private:
+        struct Slot {
+            bool valid;
+            bool out;
+            uint8_t id;
+            uint8_t length;
+            uint8_t since_keyframe;
+            uint8_t data[HID_CAPTURE_MAX_REPORT];
+        };
+
+        Slot *_slot(bool out, uint8_t id);
+
+        bool _extend_repeat(uint32_t timestamp, bool out, uint8_t id);
+
+        void _append(const uint8_t *record, uint32_t length);
+
+        void _evict();
+
+        uint8_t _peek(uint32_t offset) const;
+
+        uint8_t *_buffer;
+        uint32_t _size;
+        uint32_t _head;
+        uint32_t _tail;
+        uint32_t _used;
+        uint32_t _base_time;
+        uint32_t _last_time;
+        bool _empty;
+        uint32_t _recorded;
+        uint32_t _evicted;
+        uint32_t _jitter;
+
+        // Newest record, if it is a repeat that can still be extended
+        bool _repeat_open;
+        bool _repeat_out;
+        uint8_t _repeat_id;
+        uint32_t _repeat_pos;
+        uint32_t _repeat_interval;
+        uint16_t _repeat_count;
+
+        Slot _slots[HID_CAPTURE_SLOTS];
+    };
+
+    /**
+    * Decodes a capture produced by HIDReportRecorder::export_capture().
+    *
+    * @code
+    * HIDReportReplayer replayer;
+    * HIDCaptureEntry entry;
+    * replayer.open(capture, size);
+    * while (replayer.next(&entry)) {
+    *     ...
+    * }
+    * @endcode
+    */
+    class HIDReportReplayer {
+    public:
+        HIDReportReplayer();
+
+        bool open(const uint8_t *capture, uint32_t size);
+
+        void rewind();
+
+        /**
+        * Decode the next report. Deltas whose keyframe was overwritten in the ring
+        * are skipped.
+        *
+        * @returns false at the end of the capture or on malformed data
+        */
+        bool next(HIDCaptureEntry *entry);
+
+        /* Number of records skipped because their keyframe was missing */
+        uint32_t skipped() const;
+
+    private:
+        struct Slot {
+            bool valid;
+            bool out;
+            uint8_t id;
+            uint8_t length;
+            uint8_t data[HID_CAPTURE_MAX_REPORT];
+        };
+
+        Slot *_slot(bool out, uint8_t id, bool claim);
+
+        bool _read_varint(uint32_t *value);
+
+        bool _apply_runs(uint8_t *dst, uint32_t length);
+
+        const uint8_t *_data;
+        uint32_t _size;
+        uint32_t _pos;
+        uint32_t _base_time;
+        uint32_t _time;
+        uint32_t _skipped;
+
+        uint16_t _repeat_left;
+        uint32_t _repeat_interval;
+        Slot *_repeat_slot;
+
+        Slot _slots[HID_CAPTURE_SLOTS];
+    };
+}
+
+#endif
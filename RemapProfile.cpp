@@ -0,0 +1,124 @@
+#include "RemapProfile.h"
+#include <string.h>
+
+using namespace arduino;
+
+RemapProfile::RemapProfile() {
+    clear();
+}
+
+void RemapProfile::clear() {
+    memset(_inputs, 0, sizeof(_inputs));
+    for (int i = 0; i < REMAP_AXES; i++) {
+        _axes[i].target = REMAP_UNMAPPED;
+        _axes[i].invert = false;
+        _axes[i].low_button = REMAP_UNMAPPED;
+        _axes[i].high_button = REMAP_UNMAPPED;
+        _axes[i].low = 0;
+        _axes[i].high = 0;
+    }
+    _update_owned();
+}
+
+void RemapProfile::_update_owned() {
+    memset(_buttons, 0, sizeof(_buttons));
+    _axis_mask = 0;
+    for (int i = 0; i < REMAP_INPUTS; i++) {
+        const Entry &entry = _inputs[i];
+        if (entry.kind == BUTTON) {
+            _buttons[entry.target / 32] |= 1ul << (entry.target % 32);
+        } else if (entry.kind == AXIS) {
+            _axis_mask |= 1 << entry.target;
+        }
+    }
+    for (int i = 0; i < REMAP_AXES; i++) {
+        const AxisEntry &axis = _axes[i];
+        if (axis.target != REMAP_UNMAPPED) {
+            _axis_mask |= 1 << axis.target;
+        }
+        if (axis.low_button != REMAP_UNMAPPED) {
+            _buttons[axis.low_button / 32] |= 1ul << (axis.low_button % 32);
+        }
+        if (axis.high_button != REMAP_UNMAPPED) {
+            _buttons[axis.high_button / 32] |= 1ul << (axis.high_button % 32);
+        }
+    }
+}
+
+bool RemapProfile::MapButton(uint8_t input, uint8_t button) {
+    if (input >= REMAP_INPUTS || button >= 128) {
+        return false;
+    }
+    _inputs[input].kind = BUTTON;
+    _inputs[input].target = button;
+    _inputs[input].value = 0;
+    _update_owned();
+    return true;
+}
+
+bool RemapProfile::MapKey(uint8_t input, uint8_t key, uint8_t modifier) {
+    if (input >= REMAP_INPUTS) {
+        return false;
+    }
+    _inputs[input].kind = KEY;
+    _inputs[input].target = key;
+    _inputs[input].value = modifier;
+    _update_owned();
+    return true;
+}
+
+bool RemapProfile::MapConsumer(uint8_t input, uint16_t usage) {
+    if (input >= REMAP_INPUTS || usage == 0) {
+        return false;
+    }
+    _inputs[input].kind = CONSUMER;
+    _inputs[input].target = 0;
+    _inputs[input].value = usage;
+    _update_owned();
+    return true;
+}
+
+bool RemapProfile::MapButtonToAxis(uint8_t input, uint8_t axis, int16_t value) {
+    if (input >= REMAP_INPUTS || axis >= REMAP_AXIS_COUNT) {
+        return false;
+    }
+    _inputs[input].kind = AXIS;
+    _inputs[input].target = axis;
+    _inputs[input].value = (uint16_t) value;
+    _update_owned();
+    return true;
+}
+
+bool RemapProfile::Unmap(uint8_t input) {
+    if (input >= REMAP_INPUTS) {
+        return false;
+    }
+    _inputs[input].kind = NONE;
+    _update_owned();
+    return true;
+}
+
+bool RemapProfile::MapAxis(uint8_t input_axis, uint8_t axis, bool invert) {
+    if (input_axis >= REMAP_AXES || (axis >= REMAP_AXIS_COUNT && axis != REMAP_UNMAPPED)) {
+        return false;
+    }
+    _axes[input_axis].target = axis;
+    _axes[input_axis].invert = invert;
+    _update_owned();
+    return true;
+}
+
+bool RemapProfile::MapAxisToButtons(uint8_t input_axis, int16_t low, uint8_t low_button, int16_t high,
+                                    uint8_t high_button) {
+    if (input_axis >= REMAP_AXES || (low_button >= 128 && low_button != REMAP_UNMAPPED) ||
+        (high_button >= 128 && high_button != REMAP_UNMAPPED)) {
+        return false;
+    }
+    AxisEntry &axis = _axes[input_axis];
+    axis.low = low;
+    axis.low_button = low_button;
+    axis.high = high;
+    axis.high_button = high_button;
+    _update_owned();
+    return true;
+}
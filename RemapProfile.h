@@ -0,0 +1,106 @@
+#ifndef REMAPPROFILE_H
+#define REMAPPROFILE_H
+
+#include <stdint.h>
+
+#define REMAP_INPUTS 64 // physical buttons, see USBKeyboardGamepad::SetInput()
+#define REMAP_AXES 8    // physical axes, see USBKeyboardGamepad::SetInputAxis()
+#define REMAP_UNMAPPED 0xFF
+
+namespace arduino {
+    class USBKeyboardGamepad;
+
+    /* Gamepad axes a profile can drive, in report order */
+    enum REMAP_AXIS {
+        REMAP_AXIS_X,
+        REMAP_AXIS_Y,
+        REMAP_AXIS_Z,
+        REMAP_AXIS_RX,
+        REMAP_AXIS_RY,
+        REMAP_AXIS_RZ,
+        REMAP_AXIS_THROTTLE,
+        REMAP_AXIS_SLIDER,
+        REMAP_AXIS_COUNT
+    };
+
+    /**
+    * A remapping profile, compiled as it is built: one fixed size entry per physical input
+    * and per physical axis, so applying it costs the same for every input however the
+    * profile looks. Several inputs may target the same button or axis.
+    *
+    * @code
+    * RemapProfile racing;
+    * racing.MapAxis(0, REMAP_AXIS_X);              // stick X steers
+    * racing.MapButtonToAxis(0, REMAP_AXIS_Z, 32767); // input 0 is full throttle
+    * racing.MapAxisToButtons(1, -16000, 0, 16000, 1); // stick Y up/down as buttons 0 and 1
+    * racing.MapKey(5, 136 + 0x29);                  // input 5 is Escape, raw HID usage 0x29
+    * gamepad.SetRemapProfile(&racing);
+    * @endcode
+    */
+    class RemapProfile {
+    public:
+        RemapProfile();
+
+        void clear();
+
+        /* Each Map* call replaces whatever the input was mapped to before */
+        bool MapButton(uint8_t input, uint8_t button);
+
+        /* Key codes as for SendKeyCode(): characters, KEY_F1..., or 136 + HID usage */
+        bool MapKey(uint8_t input, uint8_t key, uint8_t modifier = 0);
+
+        bool MapConsumer(uint8_t input, uint16_t usage);
+
+        /* Adds value to the axis while the input is pressed, values from several inputs are summed */
+        bool MapButtonToAxis(uint8_t input, uint8_t axis, int16_t value);
+
+        bool Unmap(uint8_t input);
+
+        /* REMAP_UNMAPPED as axis stops driving a gamepad axis, the thresholds stay */
+        bool MapAxis(uint8_t input_axis, uint8_t axis, bool invert = false);
+
+        /**
+        * Press low_button while the physical axis is at or below low, high_button while it is at
+        * or above high. REMAP_UNMAPPED disables either side.
+        */
+        bool MapAxisToButtons(uint8_t input_axis, int16_t low, uint8_t low_button, int16_t high,
+                              uint8_t high_button);
+
+    private:
+        friend class USBKeyboardGamepad;
+
+        enum Kind {
+            NONE,
+            BUTTON,
+            KEY,
+            CONSUMER,
+            AXIS,
+        };
+
+        struct Entry {
+            uint8_t kind;
+            uint8_t target;   /*!< button, key or axis */
+            uint16_t value;   /*!< modifier, consumer usage or axis value */
+        };
+
+        struct AxisEntry {
+            uint8_t target;
+            bool invert;
+            uint8_t low_button;
+            uint8_t high_button;
+            int16_t low;
+            int16_t high;
+        };
+
+        void _update_owned();
+
+        Entry _inputs[REMAP_INPUTS];
+        AxisEntry _axes[REMAP_AXES];
+
+        // Gamepad buttons and axes the profile drives, the rest is left to SetButton()/SetX()...
+        uint32_t _buttons[4];
+        uint8_t _axis_mask;
+    };
+}
+
+#endif
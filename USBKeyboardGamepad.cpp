@@ -4,6 +4,8 @@
 
 #include "USBKeyboardGamepad.h"
 #include "usb_phy_api.h"
+#include "platform/mbed_critical.h"
+#include "platform/mbed_atomic.h"
 
 using namespace arduino;
 
@@ -340,18 +342,85 @@ USBKeyboardGamepad::USBKeyboardGamepad(bool connect_blocking,
                                        uint16_t product_id,
                                        uint16_t product_release) :
         USBHID(get_usb_phy(), 0, 0, vendor_id, product_id, product_release) {
-    _lock_status = 0;
-    for (int i = 0; i < 4; i++) {
-        SetHat(i, HAT_DIR_C);
-    }
+    _init(connect_blocking);
 }
 
 USBKeyboardGamepad::USBKeyboardGamepad(USBPhy *phy, uint16_t vendor_id, uint16_t product_id, uint16_t product_release)
         : USBHID(phy, 0, 0, vendor_id, product_id, product_release) {
+    _init(false);
+}
+
+void USBKeyboardGamepad::_init(bool connect_blocking) {
+    _connect_blocking = connect_blocking;
+    _enumerated = false;
     _lock_status = 0;
+    _recorder = nullptr;
+    _gamepad_sent = false;
+    _passthrough_forward = false;
+    _passthrough_staged = false;
+    _send_timeout = SEND_TIMEOUT_MS;
+    _tx_busy = false;
+    _tx_start = 0;
+    _tx_last = 0;
+    _pending = 0;
+    // Reports live permanently in their endpoint buffers, report ID at byte 0
+    memset(&_gamepad, 0, sizeof(_gamepad));
+    _gamepad.data[0] = REPORT_ID_GAMEPAD;
+    _gamepad.length = 1 + GAMEPAD_STATE_SIZE;
+    inputArray = &_gamepad.data[1];
+    memset(&_keyboard, 0, sizeof(_keyboard));
+    _keyboard.data[0] = REPORT_ID_KEYBOARD;
+    _keyboard.length = 9;
+    memset(&_consumer, 0, sizeof(_consumer));
+    _consumer.data[0] = REPORT_ID_CONSUMER;
+    _consumer.length = 1 + 2 * CONSUMER_SLOTS;
+    memset(_sent_consumer, 0, sizeof(_sent_consumer));
+    memset(_sent_keyboard, 0, sizeof(_sent_keyboard));
+    _frame_open = false;
+    memset(&_mouse, 0, sizeof(_mouse));
+    _mouse.data[0] = REPORT_ID_MOUSE;
+    _mouse.length = 8;
+    memset(&_motion, 0, sizeof(_motion));
+    _motion.data[0] = REPORT_ID_MOTION;
+    _motion.length = 3 + MOTION_SAMPLE_SIZE * MOTION_BATCH;
+    _motion_head = 0;
+    _motion_tail = 0;
+    _motion_dropped = 0;
+    _mouse_dx = 0;
+    _mouse_dy = 0;
+    _mouse_wheel = 0;
+    _mouse_pan = 0;
+    _mouse_buttons = 0;
+    _sent_mouse_buttons = 0;
+    memset(_held, 0, sizeof(_held));
+    memset(_turbo, 0, sizeof(_turbo));
+    memset(_chords, 0, sizeof(_chords));
+    _engine_running = false;
+    memset(_inputs, 0, sizeof(_inputs));
+    memset(_input_axes, 0, sizeof(_input_axes));
+    memset(_remap_prev, 0, sizeof(_remap_prev));
+    memset(_remap_entries, 0, sizeof(_remap_entries));
+    memset(_remap_buttons, 0, sizeof(_remap_buttons));
+    _remap_axes = 0;
+    memset(_axes, 0, sizeof(_axes));
+    _remap_profile = NULL;
+    _remap_applied = NULL;
+#if ANALOG_BUTTONS > 0
+    for (int i = 0; i < ANALOG_BUTTONS; i++) {
+        _analog[i].button = ANALOG_NO_BUTTON;
+        _analog[i].extreme = 0;
+        _analog[i].pressed = false;
+        _analog[i].armed = false;
+    }
+#endif
     for (int i = 0; i < 4; i++) {
         SetHat(i, HAT_DIR_C);
     }
+    for (int i = 0; i < REPORT_ID_COUNT; i++) {
+        _idle_rate[i] = IDLE_RATE_DEFAULT;
+        _idle_stamp[i] = 0;
+    }
+    _idle_rate[REPORT_ID_KEYBOARD] = IDLE_RATE_KEYBOARD;
 }
 
 USBKeyboardGamepad::~USBKeyboardGamepad() {
@@ -395,33 +464,25 @@ const uint8_t *USBKeyboardGamepad::report_desc() {
             REPORT_COUNT(1), 0x06,
             REPORT_SIZE(1), 0x08,
             LOGICAL_MINIMUM(1), 0x00,
-            LOGICAL_MAXIMUM(1), 0x65,
+            LOGICAL_MAXIMUM(1), 0x77,               // 255 - 136, the highest raw code SendKeyCode() takes
             USAGE_PAGE(1), 0x07,                    // Key Codes
             USAGE_MINIMUM(1), 0x00,
-            USAGE_MAXIMUM(1), 0x65,
+            USAGE_MAXIMUM(1), 0x77,
             INPUT(1), 0x00,                         // Data, Array
             END_COLLECTION(0),
 
-            // Media Control
+            // Consumer Control, array of the usages currently held
             USAGE_PAGE(1), 0x0C,
             USAGE(1), 0x01,
             COLLECTION(1), 0x01,
-            REPORT_ID(1), REPORT_ID_VOLUME,
-            USAGE_PAGE(1), 0x0C,
+            REPORT_ID(1), REPORT_ID_CONSUMER,
             LOGICAL_MINIMUM(1), 0x00,
-            LOGICAL_MAXIMUM(1), 0x01,
-            REPORT_SIZE(1), 0x01,
-            REPORT_COUNT(1), 0x07,
-            USAGE(1), 0xB5,             // Next Track
-            USAGE(1), 0xB6,             // Previous Track
-            USAGE(1), 0xB7,             // Stop
-            USAGE(1), 0xCD,             // Play / Pause
-            USAGE(1), 0xE2,             // Mute
-            USAGE(1), 0xE9,             // Volume Up
-            USAGE(1), 0xEA,             // Volume Down
-            INPUT(1), 0x02,             // Input (Data, Variable, Absolute)
-            REPORT_COUNT(1), 0x01,
-            INPUT(1), 0x01,
+            LOGICAL_MAXIMUM(2), 0xFF, 0x03,
+            USAGE_MINIMUM(1), 0x00,
+            USAGE_MAXIMUM(2), 0xFF, 0x03,
+            REPORT_SIZE(1), 0x10,
+            REPORT_COUNT(1), CONSUMER_SLOTS,
+            INPUT(1), 0x00,             // Input (Data, Array, Absolute)
             END_COLLECTION(0),
 
             // Gamepad
@@ -456,7 +517,7 @@ const uint8_t *USBKeyboardGamepad::report_desc() {
             0x65, 0x14,     // UNIT (Eng Rot:Angular Pos)
             0x75, 0x04,     // REPORT_SIZE (4)
             0x95, 0x01,     // REPORT_COUNT (1)
-            0x81, 0x02,     // INPUT(Data, Var, Abs)
+            0x81, 0x42,     // INPUT(Data, Var, Abs, Null) ;HAT_DIR_C is outside 0-7
 
             0x09, 0x39,     // USAGE (HATSWITCH)
             0x15, 0x00,     // LOGICAL_MINIMUM (0)
@@ -466,7 +527,7 @@ const uint8_t *USBKeyboardGamepad::report_desc() {
             0x65, 0x14,     // UNIT (Eng Rot:Angular Pos)
             0x75, 0x04,     // REPORT_SIZE (4)
             0x95, 0x01,     // REPORT_COUNT (1)
-            0x81, 0x02,     // INPUT(Data, Var, Abs)
+            0x81, 0x42,     // INPUT(Data, Var, Abs, Null) ;HAT_DIR_C is outside 0-7
 
             0x09, 0x39,     // USAGE (HATSWITCH)
             0x15, 0x00,     // LOGICAL_MINIMUM (0)
@@ -476,7 +537,7 @@ const uint8_t *USBKeyboardGamepad::report_desc() {
             0x65, 0x14,     // UNIT (Eng Rot:Angular Pos)
             0x75, 0x04,     // REPORT_SIZE (4)
             0x95, 0x01,     // REPORT_COUNT (1)
-            0x81, 0x02,     // INPUT(Data, Var, Abs)
+            0x81, 0x42,     // INPUT(Data, Var, Abs, Null) ;HAT_DIR_C is outside 0-7
 
             0x09, 0x39,     // USAGE (HATSWITCH)
             0x15, 0x00,     // LOGICAL_MINIMUM (0)
@@ -486,7 +547,7 @@ const uint8_t *USBKeyboardGamepad::report_desc() {
             0x65, 0x14,     // UNIT (Eng Rot:Angular Pos)
             0x75, 0x04,     // REPORT_SIZE (4)
             0x95, 0x01,     // REPORT_COUNT (1)
-            0x81, 0x02,     // INPUT(Data, Var, Abs)
+            0x81, 0x42,     // INPUT(Data, Var, Abs, Null) ;HAT_DIR_C is outside 0-7
 
             0x09, 0x32,       // USAGE (Z)
             0x09, 0x33,       // USAGE (Rx)
@@ -503,7 +564,7 @@ const uint8_t *USBKeyboardGamepad::report_desc() {
             0x16, 0x01, 0x80, //LOGICAL_MINIMUM (-32767)
             0x26, 0xFF, 0x7F, //LOGICAL_MAXIMUM (32767)
             0x75, 0x10,       //     REPORT_SIZE (16)
-            0x95, 0x01,       //     REPORT_COUNT (2)
+            0x95, 0x01,       //     REPORT_COUNT (1)
             0x81, 0x02,                    //   INPUT (Data,Var,Abs)
 
             0x05, 0x01,       // USAGE_PAGE (Generic Desktop) // analog axes
@@ -511,63 +572,257 @@ const uint8_t *USBKeyboardGamepad::report_desc() {
             0x16, 0x01, 0x80, //LOGICAL_MINIMUM (-32767)
             0x26, 0xFF, 0x7F, //LOGICAL_MAXIMUM (32767)
             0x75, 0x10,       //     REPORT_SIZE (16)
-            0x95, 0x01,       //     REPORT_COUNT (2)
+            0x95, 0x01,       //     REPORT_COUNT (1)
             0x81, 0x02,                    //   INPUT (Data,Var,Abs)
 
-            0xc0 // END_COLLECTION
+#if ANALOG_BUTTONS > 0
+            0x05, 0x02,       // USAGE_PAGE (Simulation Controls) // analog triggers, what stock drivers read
+            0x09, 0xC4,       //   USAGE (Accelerator) ;analog button 0
+#if ANALOG_BUTTONS > 1
+            0x09, 0xC5,       //   USAGE (Brake) ;analog button 1
+#endif
+            0x15, 0x00,       // LOGICAL_MINIMUM (0)
+            0x26, 0xFF, 0x00, // LOGICAL_MAXIMUM (255)
+            0x75, 0x08,       //     REPORT_SIZE (8)
+            0x95, ANALOG_BUTTONS > 1 ? 2 : 1, // REPORT_COUNT (1 or 2)
+            0x81, 0x02,       //     INPUT (Data,Var,Abs)
+#endif
+#if ANALOG_BUTTONS > 2
+            0x06, 0x00, 0xFF, // USAGE_PAGE (Vendor Defined) // the other analog buttons, custom host software only
+            0x19, 0x03,       // USAGE_MINIMUM (3)
+            0x29, ANALOG_BUTTONS, // USAGE_MAXIMUM (ANALOG_BUTTONS), usage = analog button + 1
+            0x95, ANALOG_BUTTONS - 2, //     REPORT_COUNT (ANALOG_BUTTONS - 2)
+            0x81, 0x02,       //     INPUT (Data,Var,Abs)
+#endif
+
+            0xc0, // END_COLLECTION
+
+            // Gamepad state passthrough, same layout as the gamepad input report
+            USAGE_PAGE(2), 0x00, 0xFF,              // Vendor Defined
+            USAGE(1), 0x01,
+            COLLECTION(1), 0x01,                    // Application
+            REPORT_ID(1), REPORT_ID_PASSTHROUGH,
+            LOGICAL_MINIMUM(1), 0x00,
+            LOGICAL_MAXIMUM(2), 0xFF, 0x00,
+            REPORT_SIZE(1), 0x08,
+            REPORT_COUNT(1), GAMEPAD_STATE_SIZE,
+            USAGE(1), 0x01,
+            OUTPUT(1), 0x02,                        // Data, Variable, Absolute
+            END_COLLECTION(0),
+
+            // Mouse
+            USAGE_PAGE(1), 0x01,                    // Generic Desktop
+            USAGE(1), 0x02,                         // Mouse
+            COLLECTION(1), 0x01,                    // Application
+            REPORT_ID(1), REPORT_ID_MOUSE,
+            USAGE(1), 0x01,                         // Pointer
+            COLLECTION(1), 0x00,                    // Physical
+
+            USAGE_PAGE(1), 0x09,                    // Buttons
+            USAGE_MINIMUM(1), 0x01,
+            USAGE_MAXIMUM(1), MOUSE_BUTTONS,
+            LOGICAL_MINIMUM(1), 0x00,
+            LOGICAL_MAXIMUM(1), 0x01,
+            REPORT_SIZE(1), 0x01,
+            REPORT_COUNT(1), MOUSE_BUTTONS,
+            INPUT(1), 0x02,                         // Data, Variable, Absolute
+            REPORT_SIZE(1), 8 - MOUSE_BUTTONS,
+            REPORT_COUNT(1), 0x01,
+            INPUT(1), 0x01,                         // Constant
+
+            USAGE_PAGE(1), 0x01,                    // Generic Desktop
+            USAGE(1), 0x30,                         // X
+            USAGE(1), 0x31,                         // Y
+            LOGICAL_MINIMUM(2), 0x01, 0x80,         // -32767
+            LOGICAL_MAXIMUM(2), 0xFF, 0x7F,         // 32767
+            REPORT_SIZE(1), 0x10,
+            REPORT_COUNT(1), 0x02,
+            INPUT(1), 0x06,                         // Data, Variable, Relative
+
+            USAGE(1), 0x38,                         // Wheel
+            LOGICAL_MINIMUM(1), 0x81,               // -127
+            LOGICAL_MAXIMUM(1), 0x7F,               // 127
+            REPORT_SIZE(1), 0x08,
+            REPORT_COUNT(1), 0x01,
+            INPUT(1), 0x06,                         // Data, Variable, Relative
+
+            USAGE_PAGE(1), 0x0C,                    // Consumer
+            USAGE(2), 0x38, 0x02,                   // AC Pan
+            REPORT_COUNT(1), 0x01,
+            INPUT(1), 0x06,                         // Data, Variable, Relative
+            END_COLLECTION(0),
+            END_COLLECTION(0),
+
+            // Motion, MOTION_BATCH samples per report, see PushMotionSample() for the layout
+            USAGE_PAGE(2), 0x00, 0xFF,              // Vendor Defined
+            USAGE(1), 0x02,
+            COLLECTION(1), 0x01,                    // Application
+            REPORT_ID(1), REPORT_ID_MOTION,
+            USAGE(1), 0x03,                         // sample count
+            USAGE(1), 0x04,                         // dropped samples
+            LOGICAL_MINIMUM(1), 0x00,
+            LOGICAL_MAXIMUM(2), 0xFF, 0x00,
+            REPORT_SIZE(1), 0x08,
+            REPORT_COUNT(1), 0x02,
+            INPUT(1), 0x02,                         // Data, Variable, Absolute
+            USAGE(1), 0x05,                         // sample timestamps
+            LOGICAL_MINIMUM(1), 0x00,
+            LOGICAL_MAXIMUM(3), 0xFF, 0xFF, 0x00, 0x00, // 65535, needs the 4 byte form to stay positive
+            REPORT_SIZE(1), 0x10,
+            REPORT_COUNT(1), MOTION_BATCH,
+            INPUT(1), 0x02,                         // Data, Variable, Absolute
+            USAGE(1), 0x06,                         // accel X/Y/Z, gyro X/Y/Z per sample
+            LOGICAL_MINIMUM(2), 0x00, 0x80,         // -32768
+            LOGICAL_MAXIMUM(2), 0xFF, 0x7F,         // 32767
+            REPORT_COUNT(1), 6 * MOTION_BATCH,
+            INPUT(1), 0x02,                         // Data, Variable, Absolute
+            END_COLLECTION(0),
     };
     reportLength = sizeof(reportDescriptor);
     return reportDescriptor;
 }
 
 void USBKeyboardGamepad::SetButton(int idx, bool val) {
-    if (idx > 128 || idx < 0) {
+    USBKG_TRACE_SCOPE(TRACE_SET_BUTTON);
+    if (idx >= 128 || idx < 0) {
         return;
     }
+    core_util_critical_section_enter();
+    bitWrite(_held[idx / 32], idx % 32, val);
     bitWrite(inputArray[idx / 8], idx % 8, val);
+    core_util_critical_section_exit();
+}
+
+// Axis bytes in inputArray, in REMAP_AXIS order
+static const uint8_t remap_axis_offset[REMAP_AXIS_COUNT] = {
+        X_AXIS_LSB, Y_AXIS_LSB, Z_AXIS_LSB, Rx_AXIS_LSB, Ry_AXIS_LSB, Rz_AXIS_LSB, THROTTLE_AXIS_LSB, S0_AXIS_LSB,
+};
+
+void USBKeyboardGamepad::_set_axis(uint8_t axis, uint16_t val) {
+    // -32768 is outside the descriptor's symmetric range
+    if (val == 0x8000) {
+        val = 0x8001;
+    }
+    // Both bytes at once, the engine tick may send inputArray between two stores
+    core_util_critical_section_enter();
+    _axes[axis] = val;
+    // An axis the remap profile drives gets this value back once the profile lets go of it
+    if (!(_remap_axes & (1 << axis))) {
+        inputArray[remap_axis_offset[axis]] = LSB(val);
+        inputArray[remap_axis_offset[axis] + 1] = MSB(val);
+    }
+    core_util_critical_section_exit();
 }
 
 void USBKeyboardGamepad::SetX(uint16_t val) {
-    inputArray[X_AXIS_LSB] = LSB(val);
-    inputArray[X_AXIS_MSB] = MSB(val);
+    _set_axis(REMAP_AXIS_X, val);
 }
 
 void USBKeyboardGamepad::SetY(uint16_t val) {
-    inputArray[Y_AXIS_LSB] = LSB(val);
-    inputArray[Y_AXIS_MSB] = MSB(val);
+    _set_axis(REMAP_AXIS_Y, val);
 }
 
 void USBKeyboardGamepad::SetZ(uint16_t val) {
-    inputArray[Z_AXIS_LSB] = LSB(val);
-    inputArray[Z_AXIS_MSB] = MSB(val);
+    _set_axis(REMAP_AXIS_Z, val);
 }
 
 void USBKeyboardGamepad::SetRx(uint16_t val) {
-    inputArray[Rx_AXIS_LSB] = LSB(val);
-    inputArray[Rx_AXIS_MSB] = MSB(val);
+    _set_axis(REMAP_AXIS_RX, val);
 }
 
 void USBKeyboardGamepad::SetRy(uint16_t val) {
-    inputArray[Ry_AXIS_LSB] = LSB(val);
-    inputArray[Ry_AXIS_MSB] = MSB(val);
+    _set_axis(REMAP_AXIS_RY, val);
 }
 
 void USBKeyboardGamepad::SetRz(uint16_t val) {
-    inputArray[Rz_AXIS_LSB] = LSB(val);
-    inputArray[Rz_AXIS_MSB] = MSB(val);
+    _set_axis(REMAP_AXIS_RZ, val);
 }
 
 void USBKeyboardGamepad::SetS0(uint16_t val) {
-    inputArray[S0_AXIS_LSB] = LSB(val);
-    inputArray[S0_AXIS_MSB] = MSB(val);
+    _set_axis(REMAP_AXIS_SLIDER, val);
 }
 
 void USBKeyboardGamepad::SetThrottle(uint16_t val) {
-    inputArray[THROTTLE_AXIS_LSB] = LSB(val);
-    inputArray[THROTTLE_AXIS_MSB] = MSB(val);
+    _set_axis(REMAP_AXIS_THROTTLE, val);
+}
+
+void USBKeyboardGamepad::SetAnalogButton(uint8_t idx, uint8_t travel) {
+#if ANALOG_BUTTONS > 0
+    if (idx >= ANALOG_BUTTONS) {
+        return;
+    }
+    inputArray[ANALOG0 + idx] = travel;
+
+    AnalogButton &key = _analog[idx];
+    if (key.button == ANALOG_NO_BUTTON) {
+        return;
+    }
+    bool pressed = key.pressed;
+    if (key.sensitivity == 0) {
+        pressed = pressed ? travel >= key.release : travel >= key.actuation;
+    } else if (travel < key.release) {
+        pressed = false;
+        key.armed = false;
+        key.extreme = travel;
+    } else if (pressed) {
+        // Released on the way back up, the deepest point so far is the reference
+        if (travel > key.extreme) {
+            key.extreme = travel;
+        } else if (key.extreme - travel >= key.sensitivity) {
+            pressed = false;
+            key.extreme = travel;
+        }
+    } else {
+        // Pressed on the way back down, the highest point since the release is the reference
+        if (travel < key.extreme) {
+            key.extreme = travel;
+        }
+        if (key.armed ? travel - key.extreme >= key.sensitivity : travel >= key.actuation) {
+            pressed = true;
+            key.armed = true;
+            key.extreme = travel;
+        }
+    }
+    if (pressed != key.pressed) {
+        key.pressed = pressed;
+        SetButton(key.button, pressed);
+    }
+#else
+    (void) idx;
+    (void) travel;
+#endif
+}
+
+bool USBKeyboardGamepad::ConfigureAnalogButton(uint8_t idx, uint8_t button, uint8_t actuation, uint8_t release,
+                                               uint8_t sensitivity) {
+#if ANALOG_BUTTONS > 0
+    if (idx >= ANALOG_BUTTONS || (button >= 128 && button != ANALOG_NO_BUTTON) || release > actuation) {
+        return false;
+    }
+    AnalogButton &key = _analog[idx];
+    if (key.pressed && key.button != ANALOG_NO_BUTTON) {
+        SetButton(key.button, false);
+    }
+    key.button = button;
+    key.actuation = actuation;
+    key.release = release;
+    key.sensitivity = sensitivity;
+    key.extreme = inputArray[ANALOG0 + idx];
+    key.pressed = false;
+    key.armed = false;
+    return true;
+#else
+    (void) idx;
+    (void) button;
+    (void) actuation;
+    (void) release;
+    (void) sensitivity;
+    return false;
+#endif
 }
 
 void USBKeyboardGamepad::SetHat(uint8_t hatIdx, uint8_t dir) {
+    USBKG_TRACE_SCOPE(TRACE_SET_HAT);
     uint8_t hatDir[9][4] = {
             {0, 0, 0, 0},
             {0, 0, 0, 1},
@@ -578,6 +833,8 @@ void USBKeyboardGamepad::SetHat(uint8_t hatIdx, uint8_t dir) {
             {0, 1, 1, 0},
             {0, 1, 1, 1},
             {1, 0, 0, 0}};
+    // One nibble, written bit by bit, the engine tick must not send it halfway
+    core_util_critical_section_enter();
     switch (hatIdx) {
         case 0:
             for (int i = 0; i < 4; i++) {
@@ -600,20 +857,44 @@ void USBKeyboardGamepad::SetHat(uint8_t hatIdx, uint8_t dir) {
             }
             break;
     }
+    core_util_critical_section_exit();
 }
 
-bool USBKeyboardGamepad::SendGamepadUpdates() {
+bool USBKeyboardGamepad::SendGamepadUpdates(uint32_t timeout_ms) {
+    USBKG_TRACE_SCOPE(TRACE_SEND_GAMEPAD);
     _mutex.lock();
 
-    HID_REPORT report;
-    report.data[0] = REPORT_ID_GAMEPAD;
-    for (int i = 1; i < 36; i++) {
-        report.data[i] = inputArray[i - 1];
+    _apply_passthrough();
+    _remap();
+
+    // Staged, CommitFrame() decides what goes out
+    if (_frame_open) {
+        _mutex.unlock();
+        return true;
     }
 
-    report.length = 35;
+    // Unchanged state is only repeated when the host asked for it with SET_IDLE
+    bool changed = !_gamepad_sent || memcmp(inputArray, _sent_gamepad, GAMEPAD_STATE_SIZE) != 0;
+    if (!changed && !_idle_expired(REPORT_ID_GAMEPAD)) {
+        _mutex.unlock();
+        return true;
+    }
 
-    if (!send(&report)) {
+    if (!_wait_enumerated()) {
+        // Kept until the host configures the device, then only the latest state is sent
+        core_util_atomic_fetch_or_u8(&_pending, 1 << REPORT_ID_GAMEPAD);
+        _mutex.unlock();
+        return true;
+    }
+
+    // Coalesce while suspended, report_tx() sends the latest state once the host polls again
+    if (suspended()) {
+        core_util_atomic_fetch_or_u8(&_pending, 1 << REPORT_ID_GAMEPAD);
+        _mutex.unlock();
+        return true;
+    }
+
+    if (!_send(&_gamepad, timeout_ms)) {
         _mutex.unlock();
         return false;
     }
@@ -640,7 +921,7 @@ const uint8_t *USBKeyboardGamepad::configuration_desc(uint8_t index) {
             0x01,                               // bNumInterfaces
             DEFAULT_CONFIGURATION,              // bConfigurationValue
             0x00,                               // iConfiguration
-            C_RESERVED | C_SELF_POWERED,        // bmAttributes
+            C_RESERVED | C_SELF_POWERED, // bmAttributes
             C_POWER(0),                         // bMaxPower
 
             INTERFACE_DESCRIPTOR_LENGTH,        // bLength
@@ -688,73 +969,333 @@ int USBKeyboardGamepad::_getc() {
     return -1;
 }
 
-bool USBKeyboardGamepad::SendKeyCode(uint8_t key, uint8_t modifier) {
+bool USBKeyboardGamepad::SendKeyCode(uint8_t key, uint8_t modifier, uint32_t timeout_ms) {
+    USBKG_TRACE_SCOPE(TRACE_SEND_KEY);
     _mutex.lock();
 
-    uint8_t code;
-    if (key >= 136) {
-        code = key - 136;
-    } else {
-        code = keymap[key].usage;
+    // A key press is an event, there is nothing to coalesce
+    if (_frame_open || !_wait_enumerated()) {
+        _mutex.unlock();
+        return false;
+    }
+    if (suspended()) {
+        _mutex.unlock();
+        return false;
     }
 
-    // Send a simulated keyboard keypress. Returns true if successful.
-    HID_REPORT report;
+    uint8_t code = _key_usage(key);
 
-    report.data[0] = REPORT_ID_KEYBOARD;
-    report.data[1] = modifier;
-    report.data[2] = 0;
-    report.data[3] = code;
-    report.data[4] = 0;
-    report.data[5] = 0;
-    report.data[6] = 0;
-    report.data[7] = 0;
-    report.data[8] = 0;
+    // Send a simulated keyboard keypress. Returns true if successful.
+    // Only what this press added is released, keys and modifiers held by SetKey() or chords stay held.
+    core_util_critical_section_enter();
+    uint8_t added = modifier & ~_keyboard.data[1];
+    bool held = code == 0 || memchr(&_keyboard.data[3], code, 6) != NULL;
+    _keyboard_set(code, modifier, true);
+    core_util_critical_section_exit();
+
+    bool pressed = _send(&_keyboard, timeout_ms);
+
+    core_util_critical_section_enter();
+    // A chord may have taken the same key or modifier while the press was out
+    for (int i = 0; i < CHORD_MAX; i++) {
+        const Chord &chord = _chords[i];
+        if (chord.used && chord.active && chord.action == CHORD_KEY) {
+            added &= ~chord.modifier;
+            held |= chord.target == code;
+        }
+    }
+    _keyboard_set(held ? 0 : code, added, false);
+    core_util_critical_section_exit();
 
-    report.length = 9;
+    if (!pressed) {
+        _mutex.unlock();
+        return false;
+    }
 
-    if (!send(&report)) {
+    if (!_send(&_keyboard, timeout_ms)) {
+        // The press went out, so the release must follow on the next poll or after resume
+        core_util_atomic_fetch_or_u8(&_pending, 1 << REPORT_ID_KEYBOARD);
         _mutex.unlock();
         return false;
     }
 
-    report.data[1] = 0;
-    report.data[3] = 0;
+    _mutex.unlock();
+    return true;
+}
+
+void USBKeyboardGamepad::SetKey(uint8_t key, bool pressed, uint8_t modifier) {
+    _keyboard_set(_key_usage(key), modifier, pressed);
+}
+
+bool USBKeyboardGamepad::SendKeyboardUpdates(uint32_t timeout_ms) {
+    _mutex.lock();
+
+    bool changed = memcmp(&_keyboard.data[1], _sent_keyboard, sizeof(_sent_keyboard)) != 0;
+    if (_frame_open || (!changed && !_idle_expired(REPORT_ID_KEYBOARD))) {
+        _mutex.unlock();
+        return true;
+    }
+
+    // Held keys are state: keep them for after enumeration or resume
+    if (!_wait_enumerated()) {
+        core_util_atomic_fetch_or_u8(&_pending, 1 << REPORT_ID_KEYBOARD);
+        _mutex.unlock();
+        return true;
+    }
+    if (suspended()) {
+        core_util_atomic_fetch_or_u8(&_pending, 1 << REPORT_ID_KEYBOARD);
+        _mutex.unlock();
+        return true;
+    }
 
-    if (!send(&report)) {
+    bool result = _send(&_keyboard, timeout_ms);
+    _mutex.unlock();
+    return result;
+}
+
+void USBKeyboardGamepad::BeginFrame() {
+    _frame_open = true;
+}
+
+bool USBKeyboardGamepad::CommitFrame(uint32_t timeout_ms) {
+    _mutex.lock();
+    _apply_passthrough();
+    _remap();
+
+    // Decide what the frame contains and close it in one step, so the ticker and report_tx()
+    // cannot send part of it early
+    const uint8_t reports = (1 << REPORT_ID_KEYBOARD) | (1 << REPORT_ID_CONSUMER) | (1 << REPORT_ID_GAMEPAD);
+    uint8_t frame = 0;
+    core_util_critical_section_enter();
+    if (memcmp(&_keyboard.data[1], _sent_keyboard, sizeof(_sent_keyboard)) != 0) {
+        frame |= 1 << REPORT_ID_KEYBOARD;
+    }
+    if (memcmp(&_consumer.data[1], _sent_consumer, sizeof(_sent_consumer)) != 0) {
+        frame |= 1 << REPORT_ID_CONSUMER;
+    }
+    if (!_gamepad_sent || memcmp(inputArray, _sent_gamepad, GAMEPAD_STATE_SIZE) != 0) {
+        frame |= 1 << REPORT_ID_GAMEPAD;
+    }
+    bool mouse = _mouse_report();
+    _pending = (_pending & ~reports) | frame;
+    _frame_open = false;
+    core_util_critical_section_exit();
+
+    if ((frame == 0 && !mouse) || !_wait_enumerated() || suspended()) {
         _mutex.unlock();
-        return false;
+        return true;
+    }
+
+    if (timeout_ms == SEND_TIMEOUT_DEFAULT) {
+        timeout_ms = _send_timeout;
+    }
+    // The first report starts the chain, report_tx() sends each following one on the next poll
+    uint32_t start = millis();
+    while (true) {
+        core_util_critical_section_enter();
+        bool done;
+        if (_pending & frame) {
+            _flush_pending();
+            done = false;
+        } else {
+            // Mouse goes last, report_tx() may already have sent it
+            done = !mouse || _flush_mouse();
+        }
+        core_util_critical_section_exit();
+        if (done) {
+            break;
+        }
+        if (!ready() || suspended() || millis() - start >= timeout_ms) {
+            _mutex.unlock();
+            return false;
+        }
+        yield();
     }
 
     _mutex.unlock();
     return true;
 }
 
+uint8_t USBKeyboardGamepad::_key_usage(uint8_t key) {
+    if (key >= 136) {
+        return key - 136;
+    }
+    return keymap[key].usage;
+}
+
+void USBKeyboardGamepad::_keyboard_set(uint8_t code, uint8_t modifier, bool pressed) {
+    core_util_critical_section_enter();
+    if (pressed) {
+        _keyboard.data[1] |= modifier;
+    } else {
+        _keyboard.data[1] &= ~modifier;
+    }
+    int free = 0;
+    for (int i = 3; i < 9 && code != 0; i++) {
+        if (_keyboard.data[i] == code) {
+            if (!pressed) {
+                _keyboard.data[i] = 0;
+            }
+            code = 0;
+        } else if (_keyboard.data[i] == 0 && free == 0) {
+            free = i;
+        }
+    }
+    if (pressed && code != 0 && free != 0) {
+        _keyboard.data[free] = code;
+    }
+    core_util_critical_section_exit();
+}
+
 int USBKeyboardGamepad::_putc(int c) {
     return SendKeyCode(c, keymap[c].modifier);
 }
 
-bool USBKeyboardGamepad::media_control(MEDIA_KEY key) {
+bool USBKeyboardGamepad::media_control(MEDIA_KEY key, uint32_t timeout_ms) {
+    static const uint16_t usages[] = {
+            CONSUMER_SCAN_NEXT,
+            CONSUMER_SCAN_PREVIOUS,
+            CONSUMER_STOP,
+            CONSUMER_PLAY_PAUSE,
+            CONSUMER_MUTE,
+            CONSUMER_VOLUME_UP,
+            CONSUMER_VOLUME_DOWN,
+    };
+    if (key >= sizeof(usages) / sizeof(usages[0])) {
+        return false;
+    }
+    return ConsumerTap(usages[key], timeout_ms);
+}
+
+bool USBKeyboardGamepad::_consumer_held(uint16_t usage) {
+    for (int i = 0; i < CONSUMER_SLOTS; i++) {
+        if ((_consumer.data[1 + 2 * i] | (_consumer.data[2 + 2 * i] << 8)) == usage) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool USBKeyboardGamepad::_consumer_set(uint16_t usage, bool pressed) {
+    int free = -1;
+    for (int i = 0; i < CONSUMER_SLOTS; i++) {
+        uint16_t held = _consumer.data[1 + 2 * i] | (_consumer.data[2 + 2 * i] << 8);
+        if (held == usage) {
+            if (!pressed) {
+                // Keep the array packed so the host sees one entry per held usage
+                memmove(&_consumer.data[1 + 2 * i], &_consumer.data[3 + 2 * i], 2 * (CONSUMER_SLOTS - 1 - i));
+                _consumer.data[2 * CONSUMER_SLOTS - 1] = 0;
+                _consumer.data[2 * CONSUMER_SLOTS] = 0;
+            }
+            return true;
+        }
+        if (held == 0 && free < 0) {
+            free = i;
+        }
+    }
+    if (!pressed) {
+        return true;
+    }
+    if (free < 0) {
+        return false;
+    }
+    _consumer.data[1 + 2 * free] = LSB(usage);
+    _consumer.data[2 + 2 * free] = MSB(usage);
+    return true;
+}
+
+bool USBKeyboardGamepad::_send_consumer(uint32_t timeout_ms) {
+    // Only changes are sent, pressing an already held usage costs nothing
+    if (memcmp(&_consumer.data[1], _sent_consumer, sizeof(_sent_consumer)) == 0) {
+        return true;
+    }
+    if (_frame_open) {
+        return true;
+    }
+    // Held usages are state: keep them for after enumeration or resume
+    if (!_wait_enumerated()) {
+        core_util_atomic_fetch_or_u8(&_pending, 1 << REPORT_ID_CONSUMER);
+        return true;
+    }
+    if (suspended()) {
+        core_util_atomic_fetch_or_u8(&_pending, 1 << REPORT_ID_CONSUMER);
+        return true;
+    }
+    return _send(&_consumer, timeout_ms);
+}
+
+bool USBKeyboardGamepad::ConsumerPress(uint16_t usage, uint32_t timeout_ms) {
+    if (usage == 0) {
+        return false;
+    }
     _mutex.lock();
+    // Chords change the usage array from the engine ticker
+    core_util_critical_section_enter();
+    bool held = _consumer_set(usage, true);
+    core_util_critical_section_exit();
+    bool result = held && _send_consumer(timeout_ms);
+    _mutex.unlock();
+    return result;
+}
 
-    HID_REPORT report;
+bool USBKeyboardGamepad::ConsumerRelease(uint16_t usage, uint32_t timeout_ms) {
+    _mutex.lock();
+    core_util_critical_section_enter();
+    _consumer_set(usage, false);
+    core_util_critical_section_exit();
+    bool result = _send_consumer(timeout_ms);
+    _mutex.unlock();
+    return result;
+}
 
-    report.data[0] = REPORT_ID_VOLUME;
-    report.data[1] = (1 << key) & 0x7f;
+bool USBKeyboardGamepad::ConsumerReleaseAll(uint32_t timeout_ms) {
+    _mutex.lock();
+    core_util_critical_section_enter();
+    memset(&_consumer.data[1], 0, 2 * CONSUMER_SLOTS);
+    core_util_critical_section_exit();
+    bool result = _send_consumer(timeout_ms);
+    _mutex.unlock();
+    return result;
+}
 
-    report.length = 2;
+bool USBKeyboardGamepad::ConsumerTap(uint16_t usage, uint32_t timeout_ms) {
+    _mutex.lock();
 
-    if (!send(&report)) {
+    // A tap is an event, there is nothing to keep for later
+    if (_frame_open || !_wait_enumerated()) {
         _mutex.unlock();
         return false;
     }
+    if (suspended()) {
+        _mutex.unlock();
+        return false;
+    }
+
+    // A usage that is already held (ConsumerPress(), a chord) stays held and is not tapped.
+    // Chords change the usage array from the engine ticker, so check and press in one go.
+    core_util_critical_section_enter();
+    bool held = _consumer_held(usage);
+    bool set = held || _consumer_set(usage, true);
+    core_util_critical_section_exit();
+    if (held || !set) {
+        _mutex.unlock();
+        return held;
+    }
 
-    report.data[0] = REPORT_ID_VOLUME;
-    report.data[1] = 0;
+    bool pressed = _send_consumer(timeout_ms);
 
-    report.length = 2;
+    core_util_critical_section_enter();
+    _consumer_set(usage, false);
+    core_util_critical_section_exit();
 
-    if (!send(&report)) {
+    if (!pressed) {
+        _mutex.unlock();
+        return false;
+    }
+
+    if (!_send_consumer(timeout_ms)) {
+        // The press went out, so the release must follow on the next poll or after resume
+        core_util_atomic_fetch_or_u8(&_pending, 1 << REPORT_ID_CONSUMER);
         _mutex.unlock();
         return false;
     }
@@ -764,16 +1305,862 @@ bool USBKeyboardGamepad::media_control(MEDIA_KEY key) {
 }
 
 void USBKeyboardGamepad::report_rx() {
+    USBKG_TRACE_SCOPE(TRACE_REPORT_RX);
     assert_locked();
 
     HID_REPORT report;
     read_nb(&report);
+    _record(&report, true);
+
+    switch (report.data[0]) {
+        case REPORT_ID_KEYBOARD:
+            // we take [1] because [0] is the report ID
+            _lock_status = report.data[1] & 0x07;
+            break;
+        case REPORT_ID_PASSTHROUGH:
+            // Anything but one complete state block is dropped
+            if (report.length != 1 + GAMEPAD_STATE_SIZE) {
+                break;
+            }
+            // Staged, the next SendGamepadUpdates() applies it as a whole
+            memcpy(_passthrough, &report.data[1], GAMEPAD_STATE_SIZE);
+            _passthrough_staged = true;
+            if (!_passthrough_forward) {
+                break;
+            }
+            // Interrupt context, so never block here
+            core_util_critical_section_enter();
+            _apply_passthrough();
+            if (!_submit(&_gamepad)) {
+                core_util_atomic_fetch_or_u8(&_pending, 1 << REPORT_ID_GAMEPAD);
+            }
+            core_util_critical_section_exit();
+            break;
+    }
+}
+
+void USBKeyboardGamepad::_apply_passthrough() {
+    // Same critical section as _held, so the state never mixes with a half applied local change
+    core_util_critical_section_enter();
+    if (_passthrough_staged) {
+        memcpy(inputArray, _passthrough, GAMEPAD_STATE_SIZE);
+        memcpy(_held, _passthrough, sizeof(_held));
+        for (int i = 0; i < REMAP_AXIS_COUNT; i++) {
+            // Same clamp as _set_axis(), the host may send anything
+            if (inputArray[remap_axis_offset[i]] == 0x00 && inputArray[remap_axis_offset[i] + 1] == 0x80) {
+                inputArray[remap_axis_offset[i]] = 0x01;
+            }
+            _axes[i] = inputArray[remap_axis_offset[i]] | (inputArray[remap_axis_offset[i] + 1] << 8);
+        }
+        _passthrough_staged = false;
+    }
+    core_util_critical_section_exit();
+}
 
-    // we take [1] because [0] is the report ID
-    _lock_status = report.data[1] & 0x07;
+void USBKeyboardGamepad::SetPassthroughForward(bool forward) {
+    _passthrough_forward = forward;
 }
 
 uint8_t USBKeyboardGamepad::lock_status() {
     return _lock_status;
 }
 
+
+void USBKeyboardGamepad::set_recorder(HIDReportRecorder *recorder) {
+    core_util_critical_section_enter();
+    _recorder = recorder;
+    core_util_critical_section_exit();
+}
+
+void USBKeyboardGamepad::_record(const HID_REPORT *report, bool out) {
+    // report_rx() records from interrupt context
+    core_util_critical_section_enter();
+    if (_recorder) {
+        _recorder->record(micros(), out, report->data, report->length);
+    }
+    core_util_critical_section_exit();
+}
+
+bool USBKeyboardGamepad::_submit(const HID_REPORT *report) {
+    // One critical section from the copy to the bookkeeping: report_tx() must not complete the
+    // transfer before _tx_busy is set, and the ticker or report_rx() must not change the report
+    // between the copy and the snapshot of what was sent
+    core_util_critical_section_enter();
+    if (!send_nb(report)) {
+        core_util_critical_section_exit();
+        return false;
+    }
+    uint8_t report_id = report->data[0] % REPORT_ID_COUNT;
+    _tx_start = millis();
+    _tx_busy = true;
+    _tx_last = report_id;
+    _idle_stamp[report_id] = _tx_start;
+    core_util_atomic_fetch_and_u8(&_pending, ~(1 << report_id));
+    if (report_id == REPORT_ID_GAMEPAD) {
+        memcpy(_sent_gamepad, &report->data[1], GAMEPAD_STATE_SIZE);
+        _gamepad_sent = true;
+    } else if (report_id == REPORT_ID_CONSUMER) {
+        memcpy(_sent_consumer, &report->data[1], sizeof(_sent_consumer));
+    } else if (report_id == REPORT_ID_KEYBOARD) {
+        memcpy(_sent_keyboard, &report->data[1], sizeof(_sent_keyboard));
+    }
+    _record(report, false);
+    core_util_critical_section_exit();
+    return true;
+}
+
+bool USBKeyboardGamepad::_send(const HID_REPORT *report, uint32_t timeout_ms) {
+    if (timeout_ms == SEND_TIMEOUT_DEFAULT) {
+        timeout_ms = _send_timeout;
+    }
+    // send_nb() only fails while the previous report is still in flight
+    uint32_t start = millis();
+    while (!_submit(report)) {
+        if (!ready() || suspended() || millis() - start >= timeout_ms) {
+            return false;
+        }
+        yield();
+    }
+    return true;
+}
+
+void USBKeyboardGamepad::report_tx() {
+    _tx_busy = false;
+    uint8_t last = _tx_last;
+    bool state_pending = _pending & ((1 << REPORT_ID_KEYBOARD) | (1 << REPORT_ID_CONSUMER) | (1 << REPORT_ID_GAMEPAD));
+
+    // Motion is the only source that loses data while it waits. Past half a FIFO it goes first,
+    // but pending state still gets every other poll.
+    uint32_t queued = core_util_atomic_load_u32(&_motion_head) - _motion_tail;
+    if (queued >= MOTION_FIFO_SIZE / 2 && !(last == REPORT_ID_MOTION && state_pending)) {
+        _flush_motion();
+    }
+
+    // Otherwise pending state (resume, passthrough, ticker), mouse and motion take turns,
+    // starting after whichever went out last
+    int first = last == REPORT_ID_MOUSE ? 2 : last == REPORT_ID_MOTION ? 0 : 1;
+    for (int i = 0; i < 3 && !_tx_busy; i++) {
+        switch ((first + i) % 3) {
+            case 0:
+                _flush_pending();
+                break;
+            case 1:
+                _flush_mouse();
+                break;
+            default:
+                _flush_motion();
+                break;
+        }
+    }
+}
+
+void USBKeyboardGamepad::callback_state_change(USBDevice::DeviceState new_state) {
+    USBHID::callback_state_change(new_state);
+
+    if (new_state != USBDevice::Configured) {
+        _enumerated = false;
+        _tx_busy = false;
+        return;
+    }
+
+    _enumerated = true;
+    if (_on_enumerated) {
+        _on_enumerated();
+    }
+    // State set before enumeration goes out once, as a single report
+    _flush_pending();
+}
+
+void USBKeyboardGamepad::_flush_pending() {
+    // One report per call, the next one goes out from report_tx(). Held back while a frame is staged.
+    if (_frame_open) {
+        return;
+    }
+    if (_pending & (1 << REPORT_ID_KEYBOARD)) {
+        _submit(&_keyboard);
+    } else if (_pending & (1 << REPORT_ID_CONSUMER)) {
+        _submit(&_consumer);
+    } else if (_pending & (1 << REPORT_ID_GAMEPAD)) {
+        _submit(&_gamepad);
+    }
+}
+
+bool USBKeyboardGamepad::_wait_enumerated() {
+    if (_enumerated) {
+        return true;
+    }
+    if (!_connect_blocking) {
+        return false;
+    }
+    wait_ready();
+    return true;
+}
+
+bool USBKeyboardGamepad::enumerated() {
+    return _enumerated;
+}
+
+void USBKeyboardGamepad::AttachEnumerated(mbed::Callback<void()> callback) {
+    core_util_critical_section_enter();
+    _on_enumerated = callback;
+    core_util_critical_section_exit();
+}
+
+bool USBKeyboardGamepad::suspended() {
+    // No SOF or suspend event reaches the HID class, but a host that polls
+    // every bInterval never leaves a report pending this long
+    return _tx_busy && millis() - _tx_start > SUSPEND_DETECT_MS;
+}
+
+void USBKeyboardGamepad::SetSendTimeout(uint32_t timeout_ms) {
+    _send_timeout = timeout_ms;
+}
+
+bool USBKeyboardGamepad::_idle_expired(uint8_t report_id) {
+    uint8_t rate = _idle_rate[report_id];
+    return rate != 0 && millis() - _idle_stamp[report_id] >= rate * 4u;
+}
+
+uint32_t USBKeyboardGamepad::_report_snapshot(uint8_t report_id, uint8_t *dst) {
+    dst[0] = report_id;
+    switch (report_id) {
+        case REPORT_ID_KEYBOARD:
+            memcpy(dst, _keyboard.data, _keyboard.length);
+            return _keyboard.length;
+        case REPORT_ID_CONSUMER:
+            memcpy(dst, _consumer.data, _consumer.length);
+            return _consumer.length;
+        case REPORT_ID_GAMEPAD:
+            memcpy(dst, _gamepad.data, _gamepad.length);
+            return _gamepad.length;
+        case REPORT_ID_MOUSE:
+            // Relative axes have no state to report, only the buttons do
+            memset(dst, 0, _mouse.length);
+            dst[0] = REPORT_ID_MOUSE;
+            dst[1] = _mouse_buttons;
+            return _mouse.length;
+        case REPORT_ID_MOTION:
+            // Samples are a stream, an empty batch is the only state
+            memset(dst, 0, _motion.length);
+            dst[0] = REPORT_ID_MOTION;
+            return _motion.length;
+        default:
+            return 0;
+    }
+}
+
+uint32_t USBKeyboardGamepad::callback_request(const USBDevice::setup_packet_t *setup,
+                                              USBDevice::RequestResult *result, uint8_t **data) {
+    if (setup->bmRequestType.Type != CLASS_TYPE) {
+        return USBHID::callback_request(setup, result, data);
+    }
+
+    uint8_t report_id = LSB(setup->wValue);
+    uint32_t size = 0;
+    switch (setup->bRequest) {
+        case SET_IDLE:
+            // wValue: duration in the high byte, report ID (0 for all) in the low byte
+            if (report_id == 0) {
+                for (int i = 0; i < REPORT_ID_COUNT; i++) {
+                    _idle_rate[i] = MSB(setup->wValue);
+                }
+            } else if (report_id < REPORT_ID_COUNT) {
+                _idle_rate[report_id] = MSB(setup->wValue);
+            } else {
+                break;
+            }
+            *result = USBDevice::Success;
+            *data = NULL;
+            return 0;
+        case GET_IDLE:
+            if (report_id >= REPORT_ID_COUNT) {
+                break;
+            }
+            _control_buffer[0] = _idle_rate[report_id];
+            *result = USBDevice::Send;
+            *data = _control_buffer;
+            return 1;
+        case GET_REPORT:
+            // Only input reports, answered from the current state without touching the interrupt endpoint
+            if (MSB(setup->wValue) != 0x01) {
+                break;
+            }
+            size = _report_snapshot(report_id, _control_buffer);
+            if (size == 0) {
+                break;
+            }
+            *result = USBDevice::Send;
+            *data = _control_buffer;
+            return size < setup->wLength ? size : setup->wLength;
+        default:
+            return USBHID::callback_request(setup, result, data);
+    }
+
+    *result = USBDevice::Failure;
+    *data = NULL;
+    return 0;
+}
+
+bool USBKeyboardGamepad::replay(const uint8_t *capture, uint32_t size, bool timed) {
+    HIDReportReplayer replayer;
+    if (!replayer.open(capture, size)) {
+        return false;
+    }
+
+    HIDCaptureEntry entry;
+    HID_REPORT report;
+    bool first = true;
+    uint32_t capture_start = 0;
+    uint32_t start = 0;
+    while (replayer.next(&entry)) {
+        if (entry.out) {
+            continue;
+        }
+        if (first) {
+            capture_start = entry.timestamp;
+            start = micros();
+            first = false;
+        } else if (timed) {
+            uint32_t due = entry.timestamp - capture_start;
+            uint32_t elapsed = micros() - start;
+            if ((int32_t) (due - elapsed) > 0) {
+                delayMicroseconds(due - elapsed);
+            }
+        }
+
+        report.length = entry.length;
+        memcpy(report.data, entry.data, entry.length);
+
+        _mutex.lock();
+        bool sent = _send(&report);
+        _mutex.unlock();
+        if (!sent) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int32_t saturate(int32_t value, int32_t limit) {
+    return value > limit ? limit : (value < -limit ? -limit : value);
+}
+
+void USBKeyboardGamepad::MoveMouse(int32_t dx, int32_t dy) {
+    core_util_atomic_fetch_add_s32(&_mouse_dx, dx);
+    core_util_atomic_fetch_add_s32(&_mouse_dy, dy);
+}
+
+void USBKeyboardGamepad::ScrollMouse(int32_t wheel, int32_t pan) {
+    core_util_atomic_fetch_add_s32(&_mouse_wheel, wheel);
+    core_util_atomic_fetch_add_s32(&_mouse_pan, pan);
+}
+
+void USBKeyboardGamepad::SetMouseButton(uint8_t idx, bool val) {
+    if (idx >= MOUSE_BUTTONS) {
+        return;
+    }
+    core_util_critical_section_enter();
+    bitWrite(_mouse_buttons, idx, val);
+    core_util_critical_section_exit();
+}
+
+bool USBKeyboardGamepad::_mouse_report() {
+    int16_t dx = saturate(core_util_atomic_load_s32(&_mouse_dx), 32767);
+    int16_t dy = saturate(core_util_atomic_load_s32(&_mouse_dy), 32767);
+    int8_t wheel = saturate(core_util_atomic_load_s32(&_mouse_wheel), 127);
+    int8_t pan = saturate(core_util_atomic_load_s32(&_mouse_pan), 127);
+    if (dx == 0 && dy == 0 && wheel == 0 && pan == 0 && _mouse_buttons == _sent_mouse_buttons) {
+        return false;
+    }
+
+    _mouse.data[1] = _mouse_buttons;
+    _mouse.data[2] = LSB(dx);
+    _mouse.data[3] = MSB(dx);
+    _mouse.data[4] = LSB(dy);
+    _mouse.data[5] = MSB(dy);
+    _mouse.data[6] = wheel;
+    _mouse.data[7] = pan;
+    return true;
+}
+
+bool USBKeyboardGamepad::_flush_mouse() {
+    if (_frame_open) {
+        return true;
+    }
+    // Filling, submitting and consuming must not interleave with report_tx()
+    core_util_critical_section_enter();
+    bool sent = true;
+    if (_mouse_report()) {
+        sent = _submit(&_mouse);
+        if (sent) {
+            // Only what went out is taken, the remainder and new motion carry over
+            core_util_atomic_fetch_add_s32(&_mouse_dx, -(int16_t) (_mouse.data[2] | _mouse.data[3] << 8));
+            core_util_atomic_fetch_add_s32(&_mouse_dy, -(int16_t) (_mouse.data[4] | _mouse.data[5] << 8));
+            core_util_atomic_fetch_add_s32(&_mouse_wheel, -(int8_t) _mouse.data[6]);
+            core_util_atomic_fetch_add_s32(&_mouse_pan, -(int8_t) _mouse.data[7]);
+            _sent_mouse_buttons = _mouse.data[1];
+        }
+    }
+    core_util_critical_section_exit();
+    return sent;
+}
+
+bool USBKeyboardGamepad::SendMouseUpdates(uint32_t timeout_ms) {
+    _mutex.lock();
+
+    // Motion stays accumulated until it can be sent, nothing is lost
+    if (!_wait_enumerated()) {
+        _mutex.unlock();
+        return true;
+    }
+    if (suspended()) {
+        _mutex.unlock();
+        return true;
+    }
+
+    if (timeout_ms == SEND_TIMEOUT_DEFAULT) {
+        timeout_ms = _send_timeout;
+    }
+    uint32_t start = millis();
+    while (!_flush_mouse()) {
+        if (!ready() || suspended() || millis() - start >= timeout_ms) {
+            _mutex.unlock();
+            return false;
+        }
+        yield();
+    }
+
+    _mutex.unlock();
+    return true;
+}
+
+bool USBKeyboardGamepad::PushMotionSample(const int16_t accel[3], const int16_t gyro[3]) {
+    return PushMotionSample(micros(), accel, gyro);
+}
+
+bool USBKeyboardGamepad::PushMotionSample(uint32_t timestamp_us, const int16_t accel[3], const int16_t gyro[3]) {
+    uint32_t head = _motion_head;
+    if (head - core_util_atomic_load_u32(&_motion_tail) >= MOTION_FIFO_SIZE) {
+        core_util_atomic_fetch_add_u32(&_motion_dropped, 1);
+        return false;
+    }
+
+    MotionSample &sample = _motion_fifo[head % MOTION_FIFO_SIZE];
+    sample.timestamp = timestamp_us;
+    memcpy(sample.accel, accel, sizeof(sample.accel));
+    memcpy(sample.gyro, gyro, sizeof(sample.gyro));
+
+    // Publish only after the sample is written
+    core_util_atomic_store_u32(&_motion_head, head + 1);
+    return true;
+}
+
+bool USBKeyboardGamepad::_motion_report() {
+    uint32_t tail = _motion_tail;
+    uint32_t available = core_util_atomic_load_u32(&_motion_head) - tail;
+    uint32_t dropped = core_util_atomic_load_u32(&_motion_dropped);
+    if (available == 0 && dropped == 0) {
+        return false;
+    }
+    uint8_t count = available < MOTION_BATCH ? available : MOTION_BATCH;
+
+    _motion.data[1] = count;
+    _motion.data[2] = dropped > 255 ? 255 : dropped;
+    // All timestamps first, then the signed words, one descriptor item each
+    uint8_t *stamp = &_motion.data[3];
+    uint8_t *dst = stamp + 2 * MOTION_BATCH;
+    memset(stamp, 0, MOTION_SAMPLE_SIZE * MOTION_BATCH);
+    for (int i = 0; i < count; i++, stamp += 2, dst += MOTION_SAMPLE_SIZE - 2) {
+        const MotionSample &sample = _motion_fifo[(tail + i) % MOTION_FIFO_SIZE];
+        stamp[0] = LSB(sample.timestamp);
+        stamp[1] = MSB(sample.timestamp);
+        for (int axis = 0; axis < 3; axis++) {
+            dst[2 * axis] = LSB(sample.accel[axis]);
+            dst[1 + 2 * axis] = MSB(sample.accel[axis]);
+            dst[6 + 2 * axis] = LSB(sample.gyro[axis]);
+            dst[7 + 2 * axis] = MSB(sample.gyro[axis]);
+        }
+    }
+    return true;
+}
+
+bool USBKeyboardGamepad::_flush_motion() {
+    // Consumer side of the FIFO, serialized against report_tx() like _flush_mouse()
+    core_util_critical_section_enter();
+    bool sent = true;
+    if (_motion_report()) {
+        sent = _submit(&_motion);
+        if (sent) {
+            core_util_atomic_store_u32(&_motion_tail, _motion_tail + _motion.data[1]);
+            core_util_atomic_fetch_sub_u32(&_motion_dropped, _motion.data[2]);
+        }
+    }
+    core_util_critical_section_exit();
+    return sent;
+}
+
+bool USBKeyboardGamepad::SendMotionUpdates(uint32_t timeout_ms) {
+    _mutex.lock();
+
+    // Samples stay queued until they can be sent, the FIFO counts what does not fit
+    if (!_wait_enumerated() || suspended()) {
+        _mutex.unlock();
+        return true;
+    }
+
+    if (timeout_ms == SEND_TIMEOUT_DEFAULT) {
+        timeout_ms = _send_timeout;
+    }
+    uint32_t start = millis();
+    while (!_flush_motion()) {
+        if (!ready() || suspended() || millis() - start >= timeout_ms) {
+            _mutex.unlock();
+            return false;
+        }
+        yield();
+    }
+
+    _mutex.unlock();
+    return true;
+}
+
+bool USBKeyboardGamepad::SetTurbo(int idx, uint16_t period_ms, uint8_t duty_percent) {
+    if (idx >= 128 || idx < 0 || duty_percent > 100) {
+        return false;
+    }
+    uint16_t on = (uint32_t) period_ms * duty_percent / 100;
+    if (period_ms != 0 && duty_percent != 0 && on == 0) {
+        on = 1;
+    }
+
+    core_util_critical_section_enter();
+    for (int i = 0; i < TURBO_CHANNELS; i++) {
+        bitClear(_turbo[i].mask[idx / 32], idx % 32);
+    }
+    bool result = true;
+    if (period_ms != 0) {
+        // Buttons with the same rate and duty share a channel and toggle in phase
+        int channel = -1;
+        for (int i = 0; i < TURBO_CHANNELS; i++) {
+            bool used = _turbo[i].mask[0] | _turbo[i].mask[1] | _turbo[i].mask[2] | _turbo[i].mask[3];
+            if (used && _turbo[i].period == period_ms && _turbo[i].on == on) {
+                channel = i;
+                break;
+            }
+            if (!used && channel < 0) {
+                channel = i;
+            }
+        }
+        if (channel >= 0) {
+            TurboChannel &turbo = _turbo[channel];
+            bool used = turbo.mask[0] | turbo.mask[1] | turbo.mask[2] | turbo.mask[3];
+            if (!used) {
+                turbo.period = period_ms;
+                turbo.on = on;
+                turbo.phase = 0;
+            }
+            bitSet(turbo.mask[idx / 32], idx % 32);
+        } else {
+            result = false;
+        }
+    }
+    core_util_critical_section_exit();
+
+    _engine_update();
+    return result;
+}
+
+int USBKeyboardGamepad::AddChord(const uint8_t *buttons, uint8_t count, CHORD_ACTION action, uint16_t target,
+                                 uint8_t modifier) {
+    if (count == 0) {
+        return -1;
+    }
+    if (action == CHORD_BUTTON && target >= 128) {
+        return -1;
+    }
+    uint32_t mask[4] = {0, 0, 0, 0};
+    for (int i = 0; i < count; i++) {
+        if (buttons[i] >= 128) {
+            return -1;
+        }
+        bitSet(mask[buttons[i] / 32], buttons[i] % 32);
+    }
+
+    int idx = -1;
+    core_util_critical_section_enter();
+    for (int i = 0; i < CHORD_MAX; i++) {
+        Chord &chord = _chords[i];
+        if (chord.used) {
+            continue;
+        }
+        memcpy(chord.mask, mask, sizeof(mask));
+        chord.action = action;
+        chord.target = action == CHORD_KEY ? _key_usage(target) : target;
+        chord.modifier = modifier;
+        chord.active = false;
+        chord.used = true;
+        idx = i;
+        break;
+    }
+    core_util_critical_section_exit();
+
+    _engine_update();
+    return idx;
+}
+
+void USBKeyboardGamepad::RemoveChord(int idx) {
+    if (idx < 0 || idx >= CHORD_MAX) {
+        return;
+    }
+    core_util_critical_section_enter();
+    Chord &chord = _chords[idx];
+    if (chord.used && chord.active) {
+        _chord_action(chord, false);
+        if (_enumerated && !_tx_busy) {
+            _flush_pending();
+        }
+    }
+    chord.used = false;
+    core_util_critical_section_exit();
+
+    _engine_update();
+}
+
+void USBKeyboardGamepad::_chord_action(const Chord &chord, bool pressed) {
+    switch (chord.action) {
+        case CHORD_KEY:
+            _keyboard_set(chord.target, chord.modifier, pressed);
+            core_util_atomic_fetch_or_u8(&_pending, 1 << REPORT_ID_KEYBOARD);
+            break;
+        case CHORD_CONSUMER:
+            _consumer_set(chord.target, pressed);
+            core_util_atomic_fetch_or_u8(&_pending, 1 << REPORT_ID_CONSUMER);
+            break;
+        case CHORD_BUTTON:
+            // Applied to the output mask on every tick
+            break;
+    }
+}
+
+void USBKeyboardGamepad::_engine_update() {
+    bool needed = false;
+    for (int i = 0; i < TURBO_CHANNELS && !needed; i++) {
+        needed = _turbo[i].mask[0] | _turbo[i].mask[1] | _turbo[i].mask[2] | _turbo[i].mask[3];
+    }
+    for (int i = 0; i < CHORD_MAX && !needed; i++) {
+        needed = _chords[i].used;
+    }
+
+    if (needed && !_engine_running) {
+        _engine_running = true;
+        _engine_ticker.attach(mbed::callback(this, &USBKeyboardGamepad::_engine_tick),
+                              std::chrono::milliseconds(ENGINE_TICK_MS));
+    } else if (!needed && _engine_running) {
+        _engine_ticker.detach();
+        _engine_running = false;
+        // Leave the plain held buttons in the report
+        core_util_critical_section_enter();
+        memcpy(inputArray, _held, sizeof(_held));
+        core_util_critical_section_exit();
+    }
+}
+
+void USBKeyboardGamepad::_engine_tick() {
+    // Ticker interrupt, one tick per bInterval so every poll sees a fresh mask.
+    // The 128 buttons are handled as four little endian words, matching inputArray[BTN0_7..BTN120_127].
+    uint32_t out[4];
+    for (int w = 0; w < 4; w++) {
+        out[w] = _held[w];
+    }
+
+    for (int i = 0; i < TURBO_CHANNELS; i++) {
+        TurboChannel &turbo = _turbo[i];
+        if (turbo.period == 0) {
+            continue;
+        }
+        if (turbo.phase >= turbo.on) {
+            for (int w = 0; w < 4; w++) {
+                out[w] &= ~turbo.mask[w];
+            }
+        }
+        if (++turbo.phase >= turbo.period) {
+            turbo.phase = 0;
+        }
+    }
+
+    uint32_t chorded[4] = {0, 0, 0, 0};
+    for (int i = 0; i < CHORD_MAX; i++) {
+        Chord &chord = _chords[i];
+        if (!chord.used) {
+            continue;
+        }
+        bool match = true;
+        for (int w = 0; w < 4; w++) {
+            match &= (_held[w] & chord.mask[w]) == chord.mask[w];
+        }
+        if (match != chord.active) {
+            chord.active = match;
+            _chord_action(chord, match);
+        }
+        if (match) {
+            // The member buttons are consumed by the chord
+            for (int w = 0; w < 4; w++) {
+                out[w] &= ~chord.mask[w];
+            }
+            if (chord.action == CHORD_BUTTON) {
+                bitSet(chorded[chord.target / 32], chord.target % 32);
+            }
+        }
+    }
+    for (int w = 0; w < 4; w++) {
+        out[w] |= chorded[w];
+    }
+
+    if (memcmp(inputArray, out, sizeof(out)) != 0) {
+        memcpy(inputArray, out, sizeof(out));
+        core_util_atomic_fetch_or_u8(&_pending, 1 << REPORT_ID_GAMEPAD);
+    }
+    if (_pending && _enumerated && !_tx_busy) {
+        _flush_pending();
+    }
+}
+
+void USBKeyboardGamepad::SetInput(uint8_t input, bool pressed) {
+    if (input >= REMAP_INPUTS) {
+        return;
+    }
+    core_util_critical_section_enter();
+    bitWrite(_inputs[input / 32], input % 32, pressed);
+    core_util_critical_section_exit();
+}
+
+void USBKeyboardGamepad::SetInputAxis(uint8_t axis, int16_t value) {
+    if (axis >= REMAP_AXES) {
+        return;
+    }
+    _input_axes[axis] = value;
+}
+
+void USBKeyboardGamepad::SetRemapProfile(const RemapProfile *profile) {
+    core_util_atomic_store_ptr((void *volatile *) &_remap_profile, (void *) profile);
+}
+
+void USBKeyboardGamepad::_remap() {
+    // Called with _mutex held. The profile pointer is read once so a frame never mixes two profiles.
+    const RemapProfile *profile = (const RemapProfile *) core_util_atomic_load_ptr(
+            (void *const volatile *) &_remap_profile);
+    if (!profile && !_remap_applied) {
+        return;
+    }
+
+    uint32_t inputs[REMAP_INPUTS / 32];
+    core_util_critical_section_enter();
+    memcpy(inputs, _inputs, sizeof(inputs));
+    core_util_critical_section_exit();
+
+    if (_remap_applied != profile) {
+        // Release what the old profile holds before the new one takes over
+        for (int w = 0; w < REMAP_INPUTS / 32; w++) {
+            for (uint32_t bits = _remap_prev[w]; bits; bits &= bits - 1) {
+                _remap_key(_remap_entries[w * 32 + __builtin_ctz(bits)], false);
+            }
+        }
+        memset(_remap_prev, 0, sizeof(_remap_prev));
+    }
+    _remap_applied = profile;
+
+    uint32_t buttons[4] = {0, 0, 0, 0};
+    int32_t axes[REMAP_AXIS_COUNT] = {0};
+    uint32_t owned[4] = {0, 0, 0, 0};
+    uint8_t axis_mask = 0;
+
+    if (profile) {
+        memcpy(owned, profile->_buttons, sizeof(owned));
+        axis_mask = profile->_axis_mask;
+
+        // One pass over the pressed and changed inputs, one table lookup each
+        for (int w = 0; w < REMAP_INPUTS / 32; w++) {
+            uint32_t changed = inputs[w] ^ _remap_prev[w];
+            for (uint32_t bits = inputs[w] | changed; bits; bits &= bits - 1) {
+                int bit = __builtin_ctz(bits);
+                int input = w * 32 + bit;
+                bool pressed = inputs[w] & (1ul << bit);
+                // Keys and usages are released as they were pressed, even if the input was remapped since
+                if (pressed && (changed & (1ul << bit))) {
+                    _remap_entries[input] = profile->_inputs[input];
+                }
+                const RemapProfile::Entry &entry = pressed ? profile->_inputs[input] : _remap_entries[input];
+                switch (entry.kind) {
+                    case RemapProfile::BUTTON:
+                        buttons[entry.target / 32] |= (uint32_t) pressed << (entry.target % 32);
+                        break;
+                    case RemapProfile::AXIS:
+                        axes[entry.target] += pressed ? (int16_t) entry.value : 0;
+                        break;
+                    case RemapProfile::KEY:
+                    case RemapProfile::CONSUMER:
+                        if (changed & (1ul << bit)) {
+                            _remap_key(entry, pressed);
+                        }
+                        break;
+                }
+            }
+            _remap_prev[w] = inputs[w];
+        }
+
+        for (int i = 0; i < REMAP_AXES; i++) {
+            const RemapProfile::AxisEntry &axis = profile->_axes[i];
+            int32_t value = _input_axes[i];
+            if (axis.target != REMAP_UNMAPPED) {
+                axes[axis.target] += axis.invert ? -value : value;
+            }
+            if (axis.low_button != REMAP_UNMAPPED && value <= axis.low) {
+                buttons[axis.low_button / 32] |= 1ul << (axis.low_button % 32);
+            }
+            if (axis.high_button != REMAP_UNMAPPED && value >= axis.high) {
+                buttons[axis.high_button / 32] |= 1ul << (axis.high_button % 32);
+            }
+        }
+    }
+
+    // Ownership is compared with the last frame rather than read from the profile, which may have
+    // been changed with Map* or replaced since.
+    core_util_critical_section_enter();
+    // Buttons the profile drives replace the held ones, the engine ticker picks them up from _held.
+    // Buttons it no longer drives are released.
+    for (int w = 0; w < 4; w++) {
+        _held[w] = (_held[w] & ~(owned[w] | _remap_buttons[w])) | buttons[w];
+        _remap_buttons[w] = owned[w];
+    }
+    // Axes it drives are written over the SetX()... values, those it let go of get them back
+    for (int i = 0; i < REMAP_AXIS_COUNT; i++) {
+        uint16_t value = _axes[i];
+        if (axis_mask & (1 << i)) {
+            value = (uint16_t) (axes[i] > 32767 ? 32767 : axes[i] < -32767 ? -32767 : axes[i]);
+        } else if (!(_remap_axes & (1 << i))) {
+            continue;
+        }
+        inputArray[remap_axis_offset[i]] = LSB(value);
+        inputArray[remap_axis_offset[i] + 1] = MSB(value);
+    }
+    _remap_axes = axis_mask;
+    if (!_engine_running) {
+        memcpy(inputArray, _held, sizeof(_held));
+    }
+    if (_pending && _enumerated && !_tx_busy) {
+        _flush_pending();
+    }
+    core_util_critical_section_exit();
+}
+
+void USBKeyboardGamepad::_remap_key(const RemapProfile::Entry &entry, bool pressed) {
+    if (entry.kind == RemapProfile::KEY) {
+        _keyboard_set(_key_usage(entry.target), entry.value, pressed);
+        core_util_atomic_fetch_or_u8(&_pending, 1 << REPORT_ID_KEYBOARD);
+    } else if (entry.kind == RemapProfile::CONSUMER) {
+        core_util_critical_section_enter();
+        _consumer_set(entry.value, pressed);
+        core_util_critical_section_exit();
+        core_util_atomic_fetch_or_u8(&_pending, 1 << REPORT_ID_CONSUMER);
+    }
+}
@@ -8,10 +8,24 @@
 #include "PluggableUSBHID.h"
 #include "platform/Stream.h"
 #include "PlatformMutex.h"
+#include "platform/Callback.h"
+#include "drivers/Ticker.h"
+#include "HIDReportRecorder.h"
+#include "RemapProfile.h"
+#include "USBKeyboardGamepadTrace.h"
 
 #define REPORT_ID_KEYBOARD 1
-#define REPORT_ID_VOLUME 3
+#define REPORT_ID_CONSUMER 3
+#define REPORT_ID_VOLUME REPORT_ID_CONSUMER
 #define REPORT_ID_GAMEPAD 4
+#define REPORT_ID_PASSTHROUGH 5 // vendor output report carrying a full gamepad state
+#define REPORT_ID_MOUSE 6
+#define REPORT_ID_MOTION 7
+#define REPORT_ID_COUNT 8 // report IDs must stay below this
+
+// HID idle rates, in 4 ms units. 0 sends only on change.
+#define IDLE_RATE_KEYBOARD 125
+#define IDLE_RATE_DEFAULT 0
 
 // values addresses
 #define BTN0_7 0
@@ -55,6 +69,36 @@
 #define S0_AXIS_LSB 32
 #define S0_AXIS_MSB 33
 
+// 8-bit analog buttons and triggers, 0 = released, 255 = fully pressed. 0 removes the block.
+// Analog buttons 0 and 1 are declared as Accelerator and Brake, which standard gamepad drivers
+// map to the triggers. The rest are vendor defined and only reach custom host software.
+#ifndef ANALOG_BUTTONS
+#define ANALOG_BUTTONS 8
+#endif
+#if ANALOG_BUTTONS > 29
+#error "ANALOG_BUTTONS must keep the gamepad report within 64 bytes"
+#endif
+#define ANALOG0 34
+#define ANALOG_NO_BUTTON 0xFF
+
+#define GAMEPAD_STATE_SIZE (34 + ANALOG_BUTTONS)
+
+#define MOUSE_BUTTONS 5
+
+#define CONSUMER_SLOTS 4 // consumer usages that can be held at the same time
+
+#define MOTION_BATCH 4      // IMU samples per motion report, 4 kHz at one report per 1 ms poll
+#define MOTION_SAMPLE_SIZE 14
+#define MOTION_FIFO_SIZE 32 // must be a power of two
+
+#define TURBO_CHANNELS 4 // distinct turbo rate/duty combinations
+#define CHORD_MAX 8
+#define ENGINE_TICK_MS 1 // turbo/chord tick, same as the endpoint bInterval
+
+#define SEND_TIMEOUT_MS 50
+#define SEND_TIMEOUT_DEFAULT 0xFFFFFFFF // use the timeout set with SetSendTimeout()
+#define SUSPEND_DETECT_MS 5 // a report pending longer than this means the host stopped polling
+
 #define HAT_DIR_N 0
 #define HAT_DIR_NE 1
 #define HAT_DIR_E 2
@@ -89,6 +133,41 @@ namespace arduino {
         KEY_VOLUME_DOWN,    /*!< Volume Down Button */
     };
 
+    /* Common consumer page (0x0C) usages, any usage up to 0x3FF can be sent */
+    enum CONSUMER_USAGE {
+        CONSUMER_BRIGHTNESS_UP = 0x6F,
+        CONSUMER_BRIGHTNESS_DOWN = 0x70,
+        CONSUMER_PLAY = 0xB0,
+        CONSUMER_PAUSE = 0xB1,
+        CONSUMER_RECORD = 0xB2,
+        CONSUMER_FAST_FORWARD = 0xB3,
+        CONSUMER_REWIND = 0xB4,
+        CONSUMER_SCAN_NEXT = 0xB5,
+        CONSUMER_SCAN_PREVIOUS = 0xB6,
+        CONSUMER_STOP = 0xB7,
+        CONSUMER_EJECT = 0xB8,
+        CONSUMER_PLAY_PAUSE = 0xCD,
+        CONSUMER_MUTE = 0xE2,
+        CONSUMER_BASS_BOOST = 0xE5,
+        CONSUMER_VOLUME_UP = 0xE9,
+        CONSUMER_VOLUME_DOWN = 0xEA,
+        CONSUMER_AL_EMAIL = 0x18A,
+        CONSUMER_AL_CALCULATOR = 0x192,
+        CONSUMER_AL_BROWSER = 0x196,
+        CONSUMER_AC_SEARCH = 0x221,
+        CONSUMER_AC_HOME = 0x223,
+        CONSUMER_AC_BACK = 0x224,
+        CONSUMER_AC_FORWARD = 0x225,
+        CONSUMER_AC_REFRESH = 0x227,
+    };
+
+    /* What a chord does while all of its buttons are held */
+    enum CHORD_ACTION {
+        CHORD_BUTTON,       /*!< report another gamepad button instead */
+        CHORD_KEY,          /*!< hold a key, same key codes as SendKeyCode() */
+        CHORD_CONSUMER,     /*!< hold a consumer usage, see CONSUMER_USAGE */
+    };
+
     enum FUNCTION_KEY {
         KEY_F1 = 128,   /* F1 key */
         KEY_F2,         /* F2 key */
@@ -121,10 +200,18 @@ namespace arduino {
 // Xbox 360: STANDARD GAMEPAD Vendor: 045e Product: 028e)
     class USBKeyboardGamepad : public USBHID, public ::mbed::Stream {
     public:
+        /**
+        * @param connect_blocking true: sends made before the host has configured the device wait
+        *   for enumeration. false: they return right away, gamepad state is kept and sent once
+        *   enumeration completes, key and media sends fail.
+        */
         explicit USBKeyboardGamepad(bool connect_blocking = true, uint16_t vendor_id = 0x1235,
                                     uint16_t product_id = 0x0050,
                                     uint16_t product_release = 0x0001);
 
+        /**
+        * Never blocks on enumeration, see connect_blocking above
+        */
         explicit USBKeyboardGamepad(USBPhy *phy, uint16_t vendor_id = 0x1235, uint16_t product_id = 0x0050,
                                     uint16_t product_release = 0x0001);
 
@@ -148,10 +235,172 @@ namespace arduino {
 
         void SetThrottle(uint16_t val);
 
+        /**
+        * Set the travel of an analog button or trigger. If the key drives a digital button (see
+        * ConfigureAnalogButton()) its bit is updated from the travel right away. Only analog
+        * buttons 0 and 1 (the triggers) are visible to standard gamepad drivers.
+        *
+        * @param idx analog button 0 to ANALOG_BUTTONS - 1
+        * @param travel 0 released to 255 bottomed out
+        */
+        void SetAnalogButton(uint8_t idx, uint8_t travel);
+
+        /**
+        * Derive a digital button from an analog key.
+        *
+        * Without rapid trigger the button is pressed at or above actuation and released below
+        * release. With rapid trigger (sensitivity > 0) the first press still needs actuation, after
+        * that the key releases as soon as it moves up by sensitivity from its deepest point and
+        * presses again as soon as it moves down by sensitivity from its highest point, wherever
+        * that is. Travel below release resets the key and the next press needs actuation again.
+        *
+        * @param idx analog button 0 to ANALOG_BUTTONS - 1
+        * @param button digital button 0-127, ANALOG_NO_BUTTON for analog only
+        * @param actuation travel that presses the button
+        * @param release travel below which the button is always released, at most actuation
+        * @param sensitivity rapid trigger travel, 0 turns rapid trigger off
+        * @returns false if an argument is out of range
+        */
+        bool ConfigureAnalogButton(uint8_t idx, uint8_t button, uint8_t actuation, uint8_t release,
+                                   uint8_t sensitivity = 0);
+
         // 4 Hats available 0-3, direction is clockwise 0=N 1=NE 2=E 3=SE 4=S 5=SW 6=W 7=NW 8=CENTER
         void SetHat(uint8_t hatIdx, uint8_t dir);
 
-        bool SendGamepadUpdates();
+        /**
+        * Send the gamepad state if it changed. While the host is suspended the latest state is
+        * kept and sent once when it resumes, and true is returned.
+        *
+        * @param timeout_ms how long to wait for the endpoint, SEND_TIMEOUT_DEFAULT for the default
+        * @returns true if there is no error, false otherwise
+        */
+        bool SendGamepadUpdates(uint32_t timeout_ms = SEND_TIMEOUT_DEFAULT);
+
+        /**
+        * Autofire a button while it is held. Runs from a 1 ms ticker and sends the gamepad report
+        * itself, so SetButton() only has to be called on press and release.
+        *
+        * @param idx button 0-127
+        * @param period_ms length of one on/off cycle, 0 turns turbo off for this button
+        * @param duty_percent part of the cycle the button reads as pressed
+        * @returns false if all TURBO_CHANNELS are taken by other rate/duty combinations
+        */
+        bool SetTurbo(int idx, uint16_t period_ms, uint8_t duty_percent = 50);
+
+        /**
+        * Map a combination of held buttons to another button, a key or a consumer usage. While the
+        * chord is held its member buttons are removed from the report.
+        *
+        * @code
+        * //Buttons 4 + 5 together send Escape (HID usage 0x29, as a raw code)
+        *  const uint8_t combo[] = {4, 5};
+        *  gamepad.AddChord(combo, 2, CHORD_KEY, 136 + 0x29);
+        * @endcode
+        *
+        * @param buttons member buttons, 0-127
+        * @param count number of members
+        * @param action what the chord does
+        * @param target button index, key or consumer usage, depending on action. Keys are
+        *        characters as for SendKeyCode(), or 136 + HID usage for keys without one
+        *        (Escape, F13-F24, ...)
+        * @param modifier modifier keys for CHORD_KEY
+        * @returns chord index for RemoveChord(), -1 if invalid or CHORD_MAX chords exist
+        */
+        int AddChord(const uint8_t *buttons, uint8_t count, CHORD_ACTION action, uint16_t target,
+                     uint8_t modifier = 0);
+
+        void RemoveChord(int idx);
+
+        /**
+        * Physical inputs for the remap profile. They only reach the host through the active
+        * profile, applied to the whole frame when SendGamepadUpdates() is called.
+        *
+        * @param input 0 to REMAP_INPUTS - 1
+        */
+        void SetInput(uint8_t input, bool pressed);
+
+        /* @param axis 0 to REMAP_AXES - 1 */
+        void SetInputAxis(uint8_t axis, int16_t value);
+
+        /**
+        * Switch the active profile, NULL to turn remapping off. Takes effect for the next whole
+        * frame; keys and consumer usages held through the old profile are released. Buttons a
+        * profile stops driving (on a switch, or after Map* on the active profile) are released,
+        * axes go back to their last SetX()... value. The profile is not copied and must stay
+        * alive while active.
+        */
+        void SetRemapProfile(const RemapProfile *profile);
+
+        /**
+        * The host can overwrite the whole gamepad state with a REPORT_ID_PASSTHROUGH output
+        * report, laid out exactly like the gamepad input report. It is staged and applied as a
+        * whole by the next SendGamepadUpdates(), or echoed back as a gamepad input report right
+        * away with forwarding on.
+        *
+        * @param forward send the new state from report_rx() as soon as it arrives
+        */
+        void SetPassthroughForward(bool forward);
+
+        /**
+        * Add relative motion. Safe to call from interrupts and faster than the host polls:
+        * deltas accumulate until a mouse report is sent, anything beyond the 16-bit range
+        * carries over to the next report.
+        *
+        * @param dx horizontal motion, positive to the right
+        * @param dy vertical motion, positive downwards
+        */
+        void MoveMouse(int32_t dx, int32_t dy);
+
+        /**
+        * Add wheel and horizontal pan steps, accumulated like MoveMouse()
+        */
+        void ScrollMouse(int32_t wheel, int32_t pan = 0);
+
+        // Mouse buttons 0-4, 0=left 1=right 2=middle
+        void SetMouseButton(uint8_t idx, bool val);
+
+        /**
+        * Send accumulated motion and button changes. Does nothing if there are none. Motion that
+        * arrives while the report is in flight is sent automatically with the next poll.
+        *
+        * @param timeout_ms how long to wait for the endpoint, SEND_TIMEOUT_DEFAULT for the default
+        * @returns true if there is no error, false otherwise
+        */
+        bool SendMouseUpdates(uint32_t timeout_ms = SEND_TIMEOUT_DEFAULT);
+
+        /**
+        * Queue one IMU sample, stamped with micros(). Lock-free and meant to be called from the
+        * sensor's data-ready interrupt, from one context only. Queued samples go out MOTION_BATCH
+        * per REPORT_ID_MOTION report, one report per poll once the endpoint is busy.
+        *
+        * All reports share one IN endpoint. Pending state (keyboard, consumer, gamepad), mouse and
+        * motion take turns poll by poll. Once the FIFO is half full, motion goes out on every poll,
+        * except that pending state still gets every other one. The mouse keeps accumulating
+        * meanwhile and loses nothing. The full sample rate therefore reaches the host as long as it
+        * is at most MOTION_BATCH samples per poll, minus the polls taken by state changes. At a
+        * 1 ms bInterval that is 4 kHz with no state changes, and at least 2 kHz while state
+        * changes every poll.
+        *
+        * Report layout after the ID: sample count, samples dropped since the last report
+        * (saturating), MOTION_BATCH uint16 timestamps (low 16 bits of the microsecond clock),
+        * then MOTION_BATCH samples of int16 accel X/Y/Z and int16 gyro X/Y/Z, all little endian.
+        * Unused samples are zero.
+        *
+        * @returns false if the FIFO was full, the sample is dropped and counted
+        */
+        bool PushMotionSample(const int16_t accel[3], const int16_t gyro[3]);
+
+        /* Same, with the timestamp taken by the caller, e.g. latched in the interrupt */
+        bool PushMotionSample(uint32_t timestamp_us, const int16_t accel[3], const int16_t gyro[3]);
+
+        /**
+        * Start sending queued motion samples. Only needed while the endpoint is idle, after that
+        * every poll drains the FIFO on its own.
+        *
+        * @param timeout_ms how long to wait for the endpoint, SEND_TIMEOUT_DEFAULT for the default
+        * @returns true if there is no error, false otherwise
+        */
+        bool SendMotionUpdates(uint32_t timeout_ms = SEND_TIMEOUT_DEFAULT);
 
         /**
 * To send a character defined by a modifier(CTRL, SHIFT, ALT) and the key
@@ -162,10 +411,61 @@ namespace arduino {
 * @endcode
 *
 * @param modifier bit 0: KEY_CTRL, bit 1: KEY_SHIFT, bit 2: KEY_ALT (default: 0)
-* @param key character to send
-* @returns true if there is no error, false otherwise
+* @param key character to send, KEY_F1... from FUNCTION_KEY, or 136 + HID usage (up to 0x77) for any other key
+* @param timeout_ms how long to wait for the endpoint, SEND_TIMEOUT_DEFAULT for the default
+* @returns true if there is no error, false otherwise (also right away while suspended, and inside a
+*          frame, where nothing is sent; hold the key with SetKey() there instead)
 */
-        bool SendKeyCode(uint8_t key, uint8_t modifier = 0);
+        bool SendKeyCode(uint8_t key, uint8_t modifier = 0, uint32_t timeout_ms = SEND_TIMEOUT_DEFAULT);
+
+        /**
+        * Hold or release a key until it is changed again. Nothing is sent until
+        * SendKeyboardUpdates() or CommitFrame().
+        *
+        * @param key key code as for SendKeyCode()
+        * @param pressed true to hold the key
+        * @param modifier modifier keys held or released together with the key
+        */
+        void SetKey(uint8_t key, bool pressed, uint8_t modifier = 0);
+
+        /**
+        * Send the held keys if they changed, coalesced like SendGamepadUpdates().
+        *
+        * @param timeout_ms how long to wait for the endpoint, SEND_TIMEOUT_DEFAULT for the default
+        * @returns true if there is no error, false otherwise
+        */
+        bool SendKeyboardUpdates(uint32_t timeout_ms = SEND_TIMEOUT_DEFAULT);
+
+        /**
+        * Start staging a frame. Until CommitFrame() the Send*Updates() functions and
+        * ConsumerPress()/ConsumerRelease() only record state and nothing is sent, also not from
+        * the turbo/chord ticker.
+        *
+        * A frame holds state, not events: keys go in with SetKey(), consumer usages with
+        * ConsumerPress()/ConsumerRelease(). SendKeyCode(), ConsumerTap(), media_control() and
+        * printf()/putc() need a press and a release on the wire, so they return false without
+        * sending or changing anything while a frame is open.
+        *
+        * @code
+        * gamepad.BeginFrame();
+        * gamepad.SetButton(3, true);
+        * gamepad.SetKey(0, true, KEY_SHIFT);
+        * gamepad.ConsumerPress(CONSUMER_MUTE);
+        * gamepad.CommitFrame();
+        * @endcode
+        */
+        void BeginFrame();
+
+        /**
+        * Send what changed in the frame: keyboard, consumer, gamepad and mouse reports, in that
+        * order, one per poll back to back. Reports equal to what the host last received are left
+        * out. Returns once the last report has been handed to the endpoint. While suspended or not
+        * yet enumerated the reports stay pending as with the other Send functions.
+        *
+        * @param timeout_ms how long to wait for the whole frame, SEND_TIMEOUT_DEFAULT for the default
+        * @returns true if there is no error, false otherwise
+        */
+        bool CommitFrame(uint32_t timeout_ms = SEND_TIMEOUT_DEFAULT);
 
         /**
         * Send a character
@@ -176,18 +476,81 @@ namespace arduino {
         int _putc(int c) override;
 
         /**
-        * Control media keys
+        * Control media keys, a press immediately followed by a release (see ConsumerTap())
         *
         * @param key media key pressed (KEY_NEXT_TRACK, KEY_PREVIOUS_TRACK, KEY_STOP, KEY_PLAY_PAUSE, KEY_MUTE, KEY_VOLUME_UP, KEY_VOLUME_DOWN)
-        * @returns true if there is no error, false otherwise
+        * @param timeout_ms how long to wait for the endpoint, SEND_TIMEOUT_DEFAULT for the default
+        * @returns true if there is no error, false otherwise (also right away while suspended or
+        *          inside a frame, see BeginFrame())
         */
-        bool media_control(MEDIA_KEY key);
+        bool media_control(MEDIA_KEY key, uint32_t timeout_ms = SEND_TIMEOUT_DEFAULT);
+
+        /**
+        * Press and hold a consumer usage until ConsumerRelease(). Up to CONSUMER_SLOTS usages can be
+        * held together, and a report is only sent when the set of held usages changes, so the host
+        * auto-repeats e.g. volume up for as long as it is held.
+        *
+        * @code
+        * //Ramp the volume up for half a second
+        *  keyboard.ConsumerPress(CONSUMER_VOLUME_UP);
+        *  delay(500);
+        *  keyboard.ConsumerRelease(CONSUMER_VOLUME_UP);
+        * @endcode
+        *
+        * @param usage consumer page usage, see CONSUMER_USAGE
+        * @param timeout_ms how long to wait for the endpoint, SEND_TIMEOUT_DEFAULT for the default
+        * @returns true if there is no error, false otherwise (also when all slots are in use)
+        */
+        bool ConsumerPress(uint16_t usage, uint32_t timeout_ms = SEND_TIMEOUT_DEFAULT);
+
+        bool ConsumerRelease(uint16_t usage, uint32_t timeout_ms = SEND_TIMEOUT_DEFAULT);
+
+        bool ConsumerReleaseAll(uint32_t timeout_ms = SEND_TIMEOUT_DEFAULT);
+
+        /**
+        * Press and release a consumer usage, other held usages stay held. Does nothing if the
+        * usage itself is already held. Returns false right away inside a frame, use ConsumerPress()
+        * and ConsumerRelease() there (see BeginFrame()).
+        */
+        bool ConsumerTap(uint16_t usage, uint32_t timeout_ms = SEND_TIMEOUT_DEFAULT);
+
+        /**
+        * Default time a send waits for the endpoint before giving up
+        *
+        * @param timeout_ms timeout in milliseconds
+        */
+        void SetSendTimeout(uint32_t timeout_ms);
+
+        /**
+        * The mbed USB stack does not pass bus suspend to HID modules, so a suspended host is
+        * recognised by a report that has not been collected within SUSPEND_DETECT_MS.
+        *
+        * @returns true if the host has stopped polling, e.g. because it suspended the bus
+        */
+        bool suspended();
+
+        /**
+        * @returns true once the host has configured the device
+        */
+        bool enumerated();
+
+        /**
+        * Called from interrupt context each time the host configures the device
+        *
+        * @param callback function to call, or nullptr to remove it
+        */
+        void AttachEnumerated(mbed::Callback<void()> callback);
 
         /*
     * Called when a data is received on the OUT endpoint. Useful to switch on LED of LOCK keys
     */
         void report_rx() override;
 
+        /*
+    * Called when a report has been sent on the IN endpoint
+    */
+        void report_tx() override;
+
         /**
         * Read status of lock keys. Useful to switch-on/off leds according to key pressed. Only the first three bits of the result is important:
         *   - First bit: NUM_LOCK
@@ -198,6 +561,23 @@ namespace arduino {
         */
         uint8_t lock_status();
 
+        /**
+        * Log every outgoing and incoming report into recorder. Pass NULL to stop recording.
+        *
+        * @param recorder recorder to use, owned by the caller
+        */
+        void set_recorder(HIDReportRecorder *recorder);
+
+        /**
+        * Send the input reports of a capture made by HIDReportRecorder again, OUT reports are skipped
+        *
+        * @param capture capture produced by HIDReportRecorder::export_capture()
+        * @param size size of the capture in bytes
+        * @param timed keep the original spacing between reports, otherwise send back-to-back
+        * @returns true if there is no error, false otherwise
+        */
+        bool replay(const uint8_t *capture, uint32_t size, bool timed = true);
+
         /*
     * To define the report descriptor. Warning: this method has to store the length of the report descriptor in reportLength.
     *
@@ -213,13 +593,158 @@ namespace arduino {
     */
         const uint8_t *configuration_desc(uint8_t index) override;
 
+        /*
+    * Handle GET_REPORT, GET_IDLE and SET_IDLE, everything else goes to USBHID
+    */
+        uint32_t callback_request(const USBDevice::setup_packet_t *setup, USBDevice::RequestResult *result,
+                                  uint8_t **data) override;
+
+        void callback_state_change(USBDevice::DeviceState new_state) override;
+
     private:
         int _getc() override;
 
-        uint8_t inputArray[35];
+        void _init(bool connect_blocking);
+
+        bool _wait_enumerated();
+
+        bool _submit(const HID_REPORT *report);
+
+
+        bool _mouse_report();
+
+        bool _flush_mouse();
+
+        bool _motion_report();
+
+        bool _flush_motion();
+
+        void _flush_pending();
+
+        bool _consumer_held(uint16_t usage);
+
+        bool _consumer_set(uint16_t usage, bool pressed);
+
+        bool _send_consumer(uint32_t timeout_ms);
+
+        uint8_t _key_usage(uint8_t key);
+
+        void _keyboard_set(uint8_t code, uint8_t modifier, bool pressed);
+
+        void _set_axis(uint8_t axis, uint16_t val);
+
+        struct TurboChannel {
+            uint16_t period;
+            uint16_t on;
+            uint16_t phase;
+            uint32_t mask[4];
+        };
+
+        struct Chord {
+            bool used;
+            bool active;
+            uint8_t action;
+            uint8_t modifier;
+            uint16_t target;
+            uint32_t mask[4];
+        };
+
+        void _chord_action(const Chord &chord, bool pressed);
+
+        void _engine_update();
+
+        void _engine_tick();
+
+        void _remap();
+
+        void _remap_key(const RemapProfile::Entry &entry, bool pressed);
+
+        void _apply_passthrough();
+
+        struct AnalogButton {
+            uint8_t button;
+            uint8_t actuation;
+            uint8_t release;
+            uint8_t sensitivity;
+            uint8_t extreme;  // deepest point while pressed, highest while released
+            bool pressed;
+            bool armed;       // actuated since travel last went below release
+        };
+
+        uint32_t _report_snapshot(uint8_t report_id, uint8_t *dst);
+
+        bool _idle_expired(uint8_t report_id);
+
+        bool _send(const HID_REPORT *report, uint32_t timeout_ms = SEND_TIMEOUT_DEFAULT);
+
+        void _record(const HID_REPORT *report, bool out);
+
+        // Reports are kept ready to submit, report ID at data[0]. send_nb() copies them into
+        // the endpoint buffer, so they can be changed again as soon as it returns.
+        HID_REPORT _gamepad;
+        HID_REPORT _keyboard;
+        HID_REPORT _consumer;
+        uint8_t _sent_consumer[2 * CONSUMER_SLOTS];
+        uint8_t _sent_keyboard[8];
+        volatile bool _frame_open;
+        HID_REPORT _mouse;
+        volatile int32_t _mouse_dx;
+        volatile int32_t _mouse_dy;
+        volatile int32_t _mouse_wheel;
+        volatile int32_t _mouse_pan;
+        volatile uint8_t _mouse_buttons;
+        uint8_t _sent_mouse_buttons;
+
+        struct MotionSample {
+            uint32_t timestamp;
+            int16_t accel[3];
+            int16_t gyro[3];
+        };
+
+        // Single producer (data-ready interrupt), single consumer (report_tx()/SendMotionUpdates())
+        HID_REPORT _motion;
+        MotionSample _motion_fifo[MOTION_FIFO_SIZE];
+        volatile uint32_t _motion_head;
+        volatile uint32_t _motion_tail;
+        volatile uint32_t _motion_dropped;
+        uint32_t _held[4]; // buttons as set with SetButton(), before turbo and chords
+        TurboChannel _turbo[TURBO_CHANNELS];
+        Chord _chords[CHORD_MAX];
+        mbed::Ticker _engine_ticker;
+        bool _engine_running;
+        uint32_t _inputs[REMAP_INPUTS / 32];
+        int16_t _input_axes[REMAP_AXES];
+        const RemapProfile *volatile _remap_profile;
+        const RemapProfile *_remap_applied; // profile of the last frame
+        uint32_t _remap_prev[REMAP_INPUTS / 32];
+        RemapProfile::Entry _remap_entries[REMAP_INPUTS]; // what each held input pressed
+        uint32_t _remap_buttons[4]; // buttons and axes the last frame's profile drove
+        uint8_t _remap_axes;
+        uint16_t _axes[REMAP_AXIS_COUNT]; // as set with SetX()..., in REMAP_AXIS order
+#if ANALOG_BUTTONS > 0
+        AnalogButton _analog[ANALOG_BUTTONS];
+#endif
+        uint8_t *inputArray; // gamepad state, &_gamepad.data[1]
+        uint8_t _sent_gamepad[GAMEPAD_STATE_SIZE];
+        bool _passthrough_forward;
+        uint8_t _passthrough[GAMEPAD_STATE_SIZE]; // OUT report waiting for _apply_passthrough()
+        volatile bool _passthrough_staged;
+        bool _gamepad_sent;
+        uint8_t _idle_rate[REPORT_ID_COUNT];
+        uint32_t _idle_stamp[REPORT_ID_COUNT];
+        uint8_t _control_buffer[MAX_HID_REPORT_SIZE];
         uint8_t _lock_status;
         uint8_t _configuration_descriptor[41];
         PlatformMutex _mutex;
+        HIDReportRecorder *_recorder;
+        bool _connect_blocking;
+        volatile bool _enumerated;
+        mbed::Callback<void()> _on_enumerated;
+        uint32_t _send_timeout;
+        volatile bool _tx_busy;
+        volatile uint32_t _tx_start;
+        uint8_t _tx_last; // report ID of the last submit, report_tx() rotates from there
+        volatile uint8_t _pending; // bit per report ID waiting for the endpoint
     };
 }
 
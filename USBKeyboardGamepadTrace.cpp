@@ -0,0 +1,134 @@
+#include "USBKeyboardGamepadTrace.h"
+
+#ifdef USBKG_TRACE
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __MBED__
+#include "platform/mbed_critical.h"
+#define TRACE_LOCK() core_util_critical_section_enter()
+#define TRACE_UNLOCK() core_util_critical_section_exit()
+#define TRACE_IN_ISR() core_util_is_isr_active()
+#else
+#define TRACE_LOCK()
+#define TRACE_UNLOCK()
+#define TRACE_IN_ISR() false
+#endif
+
+#if defined(USBKG_TRACE_DWT) && !defined(USBKG_TRACE_HZ)
+extern "C" uint32_t SystemCoreClock;
+#define USBKG_TRACE_HZ SystemCoreClock
+#endif
+
+#ifndef USBKG_TRACE_HZ
+#define USBKG_TRACE_HZ 0
+#endif
+
+using namespace arduino;
+
+struct TraceEvent {
+    uint32_t start;
+    uint32_t cycles;
+    uint8_t point;
+    bool isr;
+};
+
+static const char *const trace_names[TRACE_POINT_COUNT] = {
+        "SetHat",
+        "SetButton",
+        "SendGamepadUpdates",
+        "SendKeyCode",
+        "report_rx",
+};
+
+static TraceStat trace_stats[TRACE_POINT_COUNT];
+static TraceEvent trace_events[USBKG_TRACE_EVENTS];
+static uint32_t trace_next;
+
+void arduino::trace_init() {
+#ifdef USBKG_TRACE_DWT
+    *(volatile uint32_t *) 0xE000EDFC |= 1u << 24; // CoreDebug->DEMCR |= TRCENA
+    *(volatile uint32_t *) 0xE0001FB0 = 0xC5ACCE55; // DWT->LAR, the M7 ignores DWT writes until unlocked
+    *(volatile uint32_t *) 0xE0001004 = 0;         // DWT->CYCCNT
+    *(volatile uint32_t *) 0xE0001000 |= 1u;       // DWT->CTRL |= CYCCNTENA
+#endif
+    trace_reset();
+}
+
+void arduino::trace_reset() {
+    TRACE_LOCK();
+    for (int i = 0; i < TRACE_POINT_COUNT; i++) {
+        trace_stats[i].count = 0;
+        trace_stats[i].min = UINT32_MAX;
+        trace_stats[i].max = 0;
+        trace_stats[i].total = 0;
+    }
+    memset(trace_events, 0, sizeof(trace_events));
+    trace_next = 0;
+    TRACE_UNLOCK();
+}
+
+void arduino::trace_record(uint8_t point, uint32_t start, uint32_t end) {
+    uint32_t cycles = end - start;
+
+    TRACE_LOCK();
+    TraceStat &stat = trace_stats[point];
+    stat.count++;
+    stat.total += cycles;
+    if (cycles < stat.min) {
+        stat.min = cycles;
+    }
+    if (cycles > stat.max) {
+        stat.max = cycles;
+    }
+
+    TraceEvent &event = trace_events[trace_next % USBKG_TRACE_EVENTS];
+    event.start = start;
+    event.cycles = cycles;
+    event.point = point;
+    event.isr = TRACE_IN_ISR();
+    trace_next++;
+    TRACE_UNLOCK();
+}
+
+const TraceStat *arduino::trace_stat(uint8_t point) {
+    return point < TRACE_POINT_COUNT ? &trace_stats[point] : nullptr;
+}
+
+void arduino::trace_dump(TraceWriter writer, void *context) {
+    char line[96];
+
+    // Copy first so tracing can keep running while the (slow) writer is called
+    static TraceStat stats[TRACE_POINT_COUNT];
+    static TraceEvent events[USBKG_TRACE_EVENTS];
+    TRACE_LOCK();
+    memcpy(stats, trace_stats, sizeof(stats));
+    memcpy(events, trace_events, sizeof(events));
+    uint32_t next = trace_next;
+    TRACE_UNLOCK();
+
+    snprintf(line, sizeof(line), "# usbkg-trace 1 hz=%lu", (unsigned long) (USBKG_TRACE_HZ));
+    writer(line, context);
+
+    for (int i = 0; i < TRACE_POINT_COUNT; i++) {
+        const TraceStat &stat = stats[i];
+        if (stat.count == 0) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "S %s %lu %lu %lu %lu", trace_names[i], (unsigned long) stat.count,
+                 (unsigned long) stat.min, (unsigned long) (stat.total / stat.count), (unsigned long) stat.max);
+        writer(line, context);
+    }
+
+    uint32_t count = next < USBKG_TRACE_EVENTS ? next : USBKG_TRACE_EVENTS;
+    for (uint32_t i = next - count; i != next; i++) {
+        const TraceEvent &event = events[i % USBKG_TRACE_EVENTS];
+        // Events are stored when their scope ends, an interrupt inside a long call comes first
+        snprintf(line, sizeof(line), "E %s %lu %lu %d", trace_names[event.point], (unsigned long) event.start,
+                 (unsigned long) event.cycles, event.isr ? 1 : 0);
+        writer(line, context);
+    }
+}
+
+#endif
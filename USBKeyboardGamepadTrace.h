@@ -0,0 +1,110 @@
+#ifndef USBKEYBOARDGAMEPADTRACE_H
+#define USBKEYBOARDGAMEPADTRACE_H
+
+#include <stdint.h>
+
+// Cycle-count tracing of the hot paths. Uncomment, or build with -DUSBKG_TRACE, to enable.
+// Without it every USBKG_TRACE_SCOPE() compiles to nothing and the functions below are empty.
+// #define USBKG_TRACE
+
+// Events kept for trace_dump(), oldest are overwritten
+#ifndef USBKG_TRACE_EVENTS
+#define USBKG_TRACE_EVENTS 256
+#endif
+
+/*
+ * Cycle counter source. Define USBKG_TRACE_CYCLES() (and USBKG_TRACE_HZ) to plug in another one.
+ * Defaults: DWT CYCCNT on Cortex-M3/M4/M7/M33, rdtsc on x86 hosts, clock_gettime() elsewhere.
+ * Cortex-M0/M0+ have no cycle counter and fall back to the microsecond ticker.
+ */
+#if defined(USBKG_TRACE) && !defined(USBKG_TRACE_CYCLES)
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__)
+#define USBKG_TRACE_DWT
+#define USBKG_TRACE_CYCLES() (*(volatile uint32_t *) 0xE0001004) // DWT->CYCCNT
+#elif defined(__ARM_ARCH_6M__) || defined(__ARM_ARCH_8M_BASE__)
+#include "hal/us_ticker_api.h"
+#define USBKG_TRACE_CYCLES() us_ticker_read()
+#define USBKG_TRACE_HZ 1000000
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define USBKG_TRACE_CYCLES() ((uint32_t) __rdtsc())
+#define USBKG_TRACE_HZ 0 // unknown, pass --hz to the host tool
+#else
+#include <time.h>
+static inline uint32_t usbkg_trace_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) (ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+#define USBKG_TRACE_CYCLES() usbkg_trace_clock()
+#define USBKG_TRACE_HZ 1000000000
+#endif
+#endif
+
+namespace arduino {
+    enum TRACE_POINT {
+        TRACE_SET_HAT,
+        TRACE_SET_BUTTON,
+        TRACE_SEND_GAMEPAD,
+        TRACE_SEND_KEY,
+        TRACE_REPORT_RX,
+        TRACE_POINT_COUNT
+    };
+
+    struct TraceStat {
+        uint32_t count;
+        uint32_t min;
+        uint32_t max;
+        uint64_t total; /*!< avg = total / count */
+    };
+
+    typedef void (*TraceWriter)(const char *line, void *context);
+
+#ifdef USBKG_TRACE
+    /* Starts the cycle counter where needed and clears all statistics */
+    void trace_init();
+
+    void trace_reset();
+
+    void trace_record(uint8_t point, uint32_t start, uint32_t end);
+
+    const TraceStat *trace_stat(uint8_t point);
+
+    /**
+    * Write the statistics and the most recent events as text lines, one call per line.
+    * extras/trace2json converts the output into a Chrome/Perfetto trace.
+    */
+    void trace_dump(TraceWriter writer, void *context);
+
+    class TraceScope {
+    public:
+        explicit TraceScope(uint8_t point) : _point(point), _start(USBKG_TRACE_CYCLES()) {}
+
+        ~TraceScope() {
+            trace_record(_point, _start, USBKG_TRACE_CYCLES());
+        }
+
+    private:
+        uint8_t _point;
+        uint32_t _start;
+    };
+#else
+    inline void trace_init() {}
+
+    inline void trace_reset() {}
+
+    inline const TraceStat *trace_stat(uint8_t) {
+        return nullptr;
+    }
+
+    inline void trace_dump(TraceWriter, void *) {}
+#endif
+}
+
+#ifdef USBKG_TRACE
+#define USBKG_TRACE_SCOPE(point) ::arduino::TraceScope _trace_scope(point)
+#else
+#define USBKG_TRACE_SCOPE(point) do {} while (0)
+#endif
+
+#endif
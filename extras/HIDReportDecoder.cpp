@@ -0,0 +1,460 @@
+#include "HIDReportDecoder.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace arduino;
+
+// Short item prefix: bTag (7-4), bType (3-2), bSize (1-0)
+#define ITEM_MAIN 0
+#define ITEM_GLOBAL 1
+#define ITEM_LOCAL 2
+#define ITEM_LONG 0xFE
+
+#define MAIN_INPUT 0x8
+#define MAIN_OUTPUT 0x9
+#define MAIN_COLLECTION 0xA
+#define MAIN_FEATURE 0xB
+#define MAIN_END_COLLECTION 0xC
+
+#define GLOBAL_USAGE_PAGE 0x0
+#define GLOBAL_LOGICAL_MINIMUM 0x1
+#define GLOBAL_LOGICAL_MAXIMUM 0x2
+#define GLOBAL_REPORT_SIZE 0x7
+#define GLOBAL_REPORT_ID 0x8
+#define GLOBAL_REPORT_COUNT 0x9
+#define GLOBAL_PUSH 0xA
+#define GLOBAL_POP 0xB
+
+#define LOCAL_USAGE 0x0
+#define LOCAL_USAGE_MINIMUM 0x1
+#define LOCAL_USAGE_MAXIMUM 0x2
+
+static const char *const desktop_names[] = {
+        "X", "Y", "Z", "Rx", "Ry", "Rz", "Slider", "Dial", "Wheel", "Hat switch",
+};
+
+static const char *const modifier_names[] = {
+        "LeftCtrl", "LeftShift", "LeftAlt", "LeftGUI", "RightCtrl", "RightShift", "RightAlt", "RightGUI",
+};
+
+static const char *const led_names[] = {
+        "NumLock", "CapsLock", "ScrollLock", "Compose", "Kana",
+};
+
+HIDReportDecoder::HIDReportDecoder() {
+    _error = "no descriptor";
+    _field_count = 0;
+    _layout_count = 0;
+    memset(_index, -1, sizeof(_index));
+}
+
+bool HIDReportDecoder::_fail(const char *error) {
+    _error = error;
+    _field_count = 0;
+    _layout_count = 0;
+    memset(_index, -1, sizeof(_index));
+    return false;
+}
+
+const char *HIDReportDecoder::error() const {
+    return _error;
+}
+
+HIDReportLayout *HIDReportDecoder::_layout(uint8_t type, uint8_t id, bool claim) {
+    if (_index[type][id] >= 0) {
+        return &_layouts[_index[type][id]];
+    }
+    if (!claim || _layout_count == HID_DECODER_MAX_REPORTS) {
+        return NULL;
+    }
+    HIDReportLayout *layout = &_layouts[_layout_count];
+    layout->type = type;
+    layout->id = id;
+    layout->length = 0;
+    layout->first = 0;
+    layout->count = 0;
+    _index[type][id] = _layout_count++;
+    return layout;
+}
+
+void HIDReportDecoder::_name(HIDField *field, int index) {
+    char *name = field->name;
+    int size = sizeof(field->name);
+    uint16_t usage = field->usage;
+
+    if (field->flags & HID_FIELD_CONSTANT) {
+        snprintf(name, size, "pad@%u", field->bit_offset);
+    } else if (!(field->flags & HID_FIELD_VARIABLE)) {
+        // Array: the value selects the usage, name the slot instead
+        const char *page = field->usage_page == 0x07 ? "Key" : field->usage_page == 0x0C ? "Consumer" : "Array";
+        snprintf(name, size, "%s[%d]", page, index);
+    } else if (field->usage_page == 0x01 && usage >= 0x30 && usage <= 0x39) {
+        snprintf(name, size, "%s", desktop_names[usage - 0x30]);
+    } else if (field->usage_page == 0x02 && usage == 0xBB) {
+        snprintf(name, size, "Throttle");
+    } else if (field->usage_page == 0x02 && (usage == 0xC4 || usage == 0xC5)) {
+        snprintf(name, size, "%s", usage == 0xC4 ? "Accelerator" : "Brake");
+    } else if (field->usage_page == 0x07 && usage >= 0xE0 && usage <= 0xE7) {
+        snprintf(name, size, "%s", modifier_names[usage - 0xE0]);
+    } else if (field->usage_page == 0x08 && usage >= 1 && usage <= 5) {
+        snprintf(name, size, "%s", led_names[usage - 1]);
+    } else if (field->usage_page == 0x09) {
+        snprintf(name, size, "Button %u", usage);
+    } else if (field->usage_page == 0x0C && usage == 0x238) {
+        snprintf(name, size, "AC Pan");
+    } else if (field->usage_page >= 0xFF00) {
+        snprintf(name, size, "Vendor:0x%04x", usage);
+    } else {
+        snprintf(name, size, "%04X:%04X", field->usage_page, usage);
+    }
+}
+
+bool HIDReportDecoder::_add_fields(uint8_t type, uint8_t flags) {
+    const Globals &g = _globals;
+    if (g.report_size == 0 || g.report_size > 32) {
+        return _fail("REPORT_SIZE must be 1-32");
+    }
+    if (_field_count + g.report_count > HID_DECODER_MAX_FIELDS) {
+        return _fail("too many fields");
+    }
+    HIDReportLayout *layout = _layout(type, g.report_id, true);
+    if (!layout) {
+        return _fail("too many reports");
+    }
+    uint16_t &bits = _bits[type][g.report_id];
+    if (bits + g.report_size * g.report_count > HID_DECODER_MAX_REPORT * 8) {
+        return _fail("report too long");
+    }
+
+    for (uint32_t i = 0; i < g.report_count; i++) {
+        HIDField *field = &_fields[_field_count];
+        _owner[_field_count] = _index[type][g.report_id];
+        _field_count++;
+        layout->count++;
+
+        field->flags = flags & (HID_FIELD_CONSTANT | HID_FIELD_VARIABLE | HID_FIELD_RELATIVE | HID_FIELD_NULL_STATE);
+        field->bit_offset = bits;
+        field->bit_size = g.report_size;
+        field->logical_min = g.logical_min;
+        field->logical_max = g.logical_max;
+
+        // Usages carry their page in the upper half when given with 4 bytes
+        uint32_t usage;
+        uint32_t usage_max = 0;
+        if (!(flags & HID_FIELD_VARIABLE)) {
+            usage = _usage_range ? _usage_min : _usage_count ? _usages[0] : 0;
+            usage_max = _usage_range ? _usage_max : usage;
+        } else if (_usage_range) {
+            usage = _usage_min + i <= _usage_max ? _usage_min + i : _usage_max;
+        } else if (_usage_count) {
+            usage = _usages[(int) i < _usage_count ? i : _usage_count - 1];
+        } else {
+            usage = 0;
+        }
+        field->usage_page = usage > 0xFFFF ? usage >> 16 : g.usage_page;
+        field->usage = usage & 0xFFFF;
+        field->usage_max = usage_max & 0xFFFF;
+
+        field->byte = bits / 8;
+        field->shift = bits % 8;
+        field->mask = field->bit_size == 32 ? 0xFFFFFFFFull : (1ull << field->bit_size) - 1;
+        field->is_signed = g.logical_min < 0;
+        _name(field, i);
+
+        bits += g.report_size;
+    }
+    return true;
+}
+
+static int32_t item_value(const uint8_t *data, int size, bool is_signed) {
+    uint32_t value = 0;
+    for (int i = 0; i < size; i++) {
+        value |= (uint32_t) data[i] << (8 * i);
+    }
+    if (is_signed && size > 0 && size < 4 && (value & (1u << (8 * size - 1)))) {
+        value |= ~0u << (8 * size);
+    }
+    return (int32_t) value;
+}
+
+bool HIDReportDecoder::parse(const uint8_t *desc, uint32_t length) {
+    memset(&_globals, 0, sizeof(_globals));
+    memset(_bits, 0, sizeof(_bits));
+    memset(_index, -1, sizeof(_index));
+    _stack_depth = 0;
+    _usage_count = 0;
+    _usage_range = false;
+    _field_count = 0;
+    _layout_count = 0;
+    bool ids = false;
+    int depth = 0;
+
+    uint32_t pos = 0;
+    while (pos < length) {
+        uint8_t prefix = desc[pos];
+        if (prefix == ITEM_LONG) {
+            if (pos + 1 >= length) {
+                return _fail("truncated long item");
+            }
+            pos += 3 + desc[pos + 1];
+            continue;
+        }
+        int size = prefix & 3;
+        size = size == 3 ? 4 : size;
+        if (pos + 1 + size > length) {
+            return _fail("truncated item");
+        }
+        const uint8_t *data = &desc[pos + 1];
+        uint8_t type = (prefix >> 2) & 3;
+        uint8_t tag = prefix >> 4;
+        uint32_t value = (uint32_t) item_value(data, size, false);
+        pos += 1 + size;
+
+        if (type == ITEM_MAIN) {
+            switch (tag) {
+                case MAIN_INPUT:
+                case MAIN_OUTPUT:
+                case MAIN_FEATURE: {
+                    uint8_t report = tag == MAIN_INPUT ? HID_INPUT : tag == MAIN_OUTPUT ? HID_OUTPUT : HID_FEATURE;
+                    if (!_add_fields(report, value)) {
+                        return false;
+                    }
+                    break;
+                }
+                case MAIN_COLLECTION:
+                    depth++;
+                    break;
+                case MAIN_END_COLLECTION:
+                    if (--depth < 0) {
+                        return _fail("END_COLLECTION without COLLECTION");
+                    }
+                    break;
+                default:
+                    return _fail("unknown main item");
+            }
+            // Local items only apply to the next main item
+            _usage_count = 0;
+            _usage_range = false;
+        } else if (type == ITEM_GLOBAL) {
+            switch (tag) {
+                case GLOBAL_USAGE_PAGE:
+                    _globals.usage_page = value;
+                    break;
+                case GLOBAL_LOGICAL_MINIMUM:
+                    _globals.logical_min = item_value(data, size, true);
+                    break;
+                case GLOBAL_LOGICAL_MAXIMUM:
+                    // Only signed if the minimum is, 0x00-0xFF is a valid unsigned range
+                    _globals.logical_max = item_value(data, size, _globals.logical_min < 0);
+                    break;
+                case GLOBAL_REPORT_SIZE:
+                    _globals.report_size = value;
+                    break;
+                case GLOBAL_REPORT_ID:
+                    if (value == 0 || value > 255) {
+                        return _fail("invalid REPORT_ID");
+                    }
+                    if (!ids && _field_count) {
+                        return _fail("REPORT_ID after fields without one");
+                    }
+                    ids = true;
+                    _globals.report_id = value;
+                    break;
+                case GLOBAL_REPORT_COUNT:
+                    _globals.report_count = value;
+                    break;
+                case GLOBAL_PUSH:
+                    if (_stack_depth == (int) (sizeof(_stack) / sizeof(_stack[0]))) {
+                        return _fail("PUSH too deep");
+                    }
+                    _stack[_stack_depth++] = _globals;
+                    break;
+                case GLOBAL_POP:
+                    if (_stack_depth == 0) {
+                        return _fail("POP without PUSH");
+                    }
+                    _globals = _stack[--_stack_depth];
+                    break;
+                default:
+                    // Physical range, units: not needed to locate or check values
+                    break;
+            }
+        } else if (type == ITEM_LOCAL) {
+            switch (tag) {
+                case LOCAL_USAGE:
+                    if (_usage_count < HID_DECODER_MAX_FIELDS) {
+                        _usages[_usage_count++] = value;
+                    }
+                    break;
+                case LOCAL_USAGE_MINIMUM:
+                    _usage_min = value;
+                    _usage_range = true;
+                    break;
+                case LOCAL_USAGE_MAXIMUM:
+                    _usage_max = value;
+                    _usage_range = true;
+                    break;
+                default:
+                    break;
+            }
+        } else {
+            return _fail("reserved item type");
+        }
+    }
+    if (depth != 0) {
+        return _fail("unterminated COLLECTION");
+    }
+
+    // Group the fields per report, items of one report may be interleaved with others
+    static HIDField sorted[HID_DECODER_MAX_FIELDS];
+    int next = 0;
+    for (int l = 0; l < _layout_count; l++) {
+        HIDReportLayout &layout = _layouts[l];
+        layout.first = next;
+        for (int i = 0; i < _field_count; i++) {
+            if (_owner[i] == l) {
+                sorted[next++] = _fields[i];
+            }
+        }
+        // Repeated usages (several hat switches) get numbered from the second one on. Numbers mean
+        // nothing for vendor fields, every repeat of a vendor usage is named by its bit offset instead.
+        for (int i = layout.first; i < next; i++) {
+            HIDField &field = sorted[i];
+            if ((field.flags & (HID_FIELD_CONSTANT | HID_FIELD_VARIABLE)) != HID_FIELD_VARIABLE) {
+                continue;
+            }
+            int seen = 0;
+            int total = 0;
+            for (int j = layout.first; j < next; j++) {
+                bool same = sorted[j].usage_page == field.usage_page && sorted[j].usage == field.usage &&
+                            (sorted[j].flags & (HID_FIELD_CONSTANT | HID_FIELD_VARIABLE)) == HID_FIELD_VARIABLE;
+                seen += same && j < i;
+                total += same;
+            }
+            if (field.usage_page >= 0xFF00) {
+                if (total > 1) {
+                    snprintf(field.name, HID_DECODER_NAME_SIZE, "Vendor:0x%04x@%u", field.usage, field.bit_offset);
+                }
+            } else if (seen) {
+                char suffix[12];
+                int length = snprintf(suffix, sizeof(suffix), " %d", seen + 1);
+                int end = strlen(field.name);
+                end = end + length < HID_DECODER_NAME_SIZE ? end : HID_DECODER_NAME_SIZE - 1 - length;
+                memcpy(field.name + end, suffix, length + 1);
+            }
+        }
+        uint16_t bits = _bits[layout.type][layout.id];
+        layout.length = (ids ? 1 : 0) + (bits + 7) / 8;
+    }
+    memcpy(_fields, sorted, sizeof(HIDField) * _field_count);
+
+    _error = NULL;
+    return true;
+}
+
+const HIDReportLayout *HIDReportDecoder::layout(uint8_t type, uint8_t id) const {
+    if (type > HID_FEATURE || _index[type][id] < 0) {
+        return NULL;
+    }
+    return &_layouts[_index[type][id]];
+}
+
+const HIDReportLayout *HIDReportDecoder::layout_at(int idx) const {
+    return idx >= 0 && idx < _layout_count ? &_layouts[idx] : NULL;
+}
+
+int HIDReportDecoder::layouts() const {
+    return _layout_count;
+}
+
+const HIDField *HIDReportDecoder::field(int idx) const {
+    return idx >= 0 && idx < _field_count ? &_fields[idx] : NULL;
+}
+
+const HIDReportLayout *HIDReportDecoder::decode(uint8_t type, const uint8_t *report, uint32_t length,
+                                                int32_t *values) const {
+    if (length == 0 || type > HID_FEATURE) {
+        return NULL;
+    }
+    // Without report IDs the layout is registered as ID 0
+    uint8_t id = _index[type][0] >= 0 ? 0 : report[0];
+    int idx = _index[type][id];
+    if (idx < 0 || _layouts[idx].length != length) {
+        return NULL;
+    }
+    const HIDReportLayout *layout = &_layouts[idx];
+
+    // Padded copy so every field can be read with one unaligned 64 bit load
+    uint8_t buffer[HID_DECODER_MAX_REPORT + 8];
+    const uint8_t *payload = id ? report + 1 : report;
+    uint32_t payload_length = id ? length - 1 : length;
+    memcpy(buffer, payload, payload_length);
+    memset(buffer + payload_length, 0, 8);
+
+    const HIDField *field = &_fields[layout->first];
+    for (int i = 0; i < layout->count; i++, field++) {
+        uint64_t word;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        memcpy(&word, &buffer[field->byte], sizeof(word));
+#else
+        word = 0;
+        for (int b = 0; b < 8; b++) {
+            word |= (uint64_t) buffer[field->byte + b] << (8 * b);
+        }
+#endif
+        uint64_t value = (word >> field->shift) & field->mask;
+        if (field->is_signed && field->bit_size < 64) {
+            int s = 64 - field->bit_size;
+            values[i] = (int32_t) ((int64_t) (value << s) >> s);
+        } else {
+            values[i] = (int32_t) value;
+        }
+    }
+    return layout;
+}
+
+int HIDReportDecoder::validate(const HIDReportLayout *layout, const int32_t *values, uint16_t *bad) const {
+    int count = 0;
+    const HIDField *field = &_fields[layout->first];
+    for (int i = 0; i < layout->count; i++, field++) {
+        int32_t value = values[i];
+        bool ok;
+        if (field->flags & HID_FIELD_CONSTANT) {
+            ok = value == 0;
+        } else if (field->flags & HID_FIELD_VARIABLE) {
+            ok = (value >= field->logical_min && value <= field->logical_max) ||
+                 (field->flags & HID_FIELD_NULL_STATE);
+        } else {
+            // Array: out of range means "no usage", only 0 is used for that here
+            ok = value == 0 || (value >= field->logical_min && value <= field->logical_max &&
+                                field->usage + (value - field->logical_min) <= field->usage_max);
+        }
+        if (!ok) {
+            if (bad) {
+                bad[count] = i;
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+void HIDReportDecoder::encode(const HIDReportLayout *layout, const int32_t *values, uint8_t *report) const {
+    uint8_t buffer[HID_DECODER_MAX_REPORT + 8];
+    memset(buffer, 0, sizeof(buffer));
+
+    const HIDField *field = &_fields[layout->first];
+    for (int i = 0; i < layout->count; i++, field++) {
+        uint64_t value = ((uint64_t) (uint32_t) values[i] & field->mask) << field->shift;
+        for (int b = 0; value; b++, value >>= 8) {
+            buffer[field->byte + b] |= value & 0xFF;
+        }
+    }
+
+    if (layout->id) {
+        report[0] = layout->id;
+        memcpy(report + 1, buffer, layout->length - 1);
+    } else {
+        memcpy(report, buffer, layout->length);
+    }
+}
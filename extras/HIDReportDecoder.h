@@ -0,0 +1,145 @@
+#ifndef HIDREPORTDECODER_H
+#define HIDREPORTDECODER_H
+
+#include <stdint.h>
+
+// Host-side only, kept in extras/ so the Arduino build does not pick it up.
+#define HID_DECODER_MAX_FIELDS 512
+#define HID_DECODER_MAX_REPORTS 32
+#define HID_DECODER_MAX_REPORT 256
+#define HID_DECODER_NAME_SIZE 24
+
+// Main item data bits
+#define HID_FIELD_CONSTANT 0x01
+#define HID_FIELD_VARIABLE 0x02
+#define HID_FIELD_RELATIVE 0x04
+#define HID_FIELD_NULL_STATE 0x40
+
+namespace arduino {
+
+    enum HID_REPORT_TYPE {
+        HID_INPUT,
+        HID_OUTPUT,
+        HID_FEATURE,
+    };
+
+    /* One value in a report. Items with REPORT_COUNT > 1 are split into one field per value. */
+    struct HIDField {
+        char name[HID_DECODER_NAME_SIZE];
+        uint16_t usage_page;
+        uint16_t usage;         /*!< array items: first usage of the range */
+        uint16_t usage_max;     /*!< array items: last usage of the range */
+        uint16_t bit_offset;    /*!< from the first byte after the report ID */
+        uint8_t bit_size;
+        uint8_t flags;          /*!< HID_FIELD_* */
+        int32_t logical_min;
+        int32_t logical_max;
+
+        // Precomputed for decode()
+        uint16_t byte;
+        uint8_t shift;
+        bool is_signed;
+        uint64_t mask;
+    };
+
+    struct HIDReportLayout {
+        uint8_t type;           /*!< HID_REPORT_TYPE */
+        uint8_t id;             /*!< 0 if the descriptor has no report IDs */
+        uint16_t length;        /*!< bytes on the wire, including the ID byte */
+        uint16_t first;         /*!< index of the first field */
+        uint16_t count;
+    };
+
+    /**
+    * Parses a HID report descriptor and turns reports back into named fields.
+    *
+    * @code
+    * HIDReportDecoder decoder;
+    * int32_t values[HID_DECODER_MAX_FIELDS];
+    * decoder.parse(desc, desc_length);
+    * const HIDReportLayout *layout = decoder.decode(HID_INPUT, report, length, values);
+    * for (int i = 0; layout && i < layout->count; i++) {
+    *     printf("%s=%d\n", decoder.field(layout->first + i)->name, values[i]);
+    * }
+    * @endcode
+    */
+    class HIDReportDecoder {
+    public:
+        HIDReportDecoder();
+
+        /**
+        * @returns false if the descriptor is malformed or exceeds the HID_DECODER_MAX_* limits,
+        *          error() says why
+        */
+        bool parse(const uint8_t *desc, uint32_t length);
+
+        const char *error() const;
+
+        const HIDReportLayout *layout(uint8_t type, uint8_t id) const;
+
+        const HIDReportLayout *layout_at(int idx) const;
+
+        int layouts() const;
+
+        const HIDField *field(int idx) const;
+
+        /**
+        * Extract every field of one report.
+        *
+        * @param report report as sent on the wire, starting with the report ID if the descriptor uses IDs
+        * @param values one entry per field of the returned layout
+        * @returns the report layout, NULL for unknown IDs or a length that does not match the descriptor
+        */
+        const HIDReportLayout *decode(uint8_t type, const uint8_t *report, uint32_t length, int32_t *values) const;
+
+        /**
+        * Check decoded values against the descriptor: variable values inside the logical range (or null,
+        * if the item allows it), array values either 0 or a valid index, constant padding zero.
+        *
+        * @returns number of violating fields, their indices (relative to layout->first) go to bad if not NULL
+        */
+        int validate(const HIDReportLayout *layout, const int32_t *values, uint16_t *bad = 0) const;
+
+        /* Inverse of decode(), for round trip tests. Writes layout->length bytes. */
+        void encode(const HIDReportLayout *layout, const int32_t *values, uint8_t *report) const;
+
+    private:
+        bool _fail(const char *error);
+
+        HIDReportLayout *_layout(uint8_t type, uint8_t id, bool claim);
+
+        bool _add_fields(uint8_t type, uint8_t flags);
+
+        void _name(HIDField *field, int index);
+
+        struct Globals {
+            uint16_t usage_page;
+            int32_t logical_min;
+            int32_t logical_max;
+            uint32_t report_size;
+            uint32_t report_count;
+            uint8_t report_id;
+        };
+
+        // Parser state
+        Globals _globals;
+        Globals _stack[4];
+        int _stack_depth;
+        uint32_t _usages[HID_DECODER_MAX_FIELDS];
+        int _usage_count;
+        uint32_t _usage_min;
+        uint32_t _usage_max;
+        bool _usage_range;
+        uint16_t _bits[3][256];
+        uint8_t _owner[HID_DECODER_MAX_FIELDS];
+
+        const char *_error;
+        HIDField _fields[HID_DECODER_MAX_FIELDS];
+        int _field_count;
+        HIDReportLayout _layouts[HID_DECODER_MAX_REPORTS];
+        int _layout_count;
+        int8_t _index[3][256];
+    };
+}
+
+#endif
@@ -0,0 +1,319 @@
+// Calls random USBKeyboardGamepad setters on the host and checks every report the device sends
+// against its own report descriptor.
+//
+// Build from the library root:
+//   c++ -O2 -I. -Iextras/host extras/fuzz_setters.cpp extras/host/host.cpp extras/HIDReportDecoder.cpp
+//       USBKeyboardGamepad.cpp RemapProfile.cpp HIDReportRecorder.cpp USBKeyboardGamepadTrace.cpp
+//       -o fuzz_setters
+//
+// Usage:
+//   fuzz_setters [N] [seed]    N random calls (default 1M), exit 1 if any report violates the descriptor
+//
+// extras/host/ stands in for USBHID and the mbed platform. The host polls whenever the library
+// waits, the engine ticker fires when the fuzzer says so.
+
+#include "USBKeyboardGamepad.h"
+#include "HIDReportDecoder.h"
+#include "platform/mbed_critical.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+using namespace arduino;
+
+static HIDReportDecoder decoder;
+static uint32_t reports;
+static uint32_t violations;
+static uint32_t per_id[REPORT_ID_COUNT];
+static const char *current = "";
+
+static void check(const HID_REPORT *report) {
+    static int32_t values[HID_DECODER_MAX_FIELDS];
+    static uint16_t bad[HID_DECODER_MAX_FIELDS];
+
+    reports++;
+    per_id[report->data[0] % REPORT_ID_COUNT]++;
+    const HIDReportLayout *layout = decoder.decode(HID_INPUT, report->data, report->length, values);
+    if (!layout) {
+        if (violations++ < 20) {
+            printf("after %s: id %u, %u bytes, not in the descriptor\n", current, report->data[0],
+                   (unsigned) report->length);
+        }
+        return;
+    }
+    int count = decoder.validate(layout, values, bad);
+    if (count == 0) {
+        return;
+    }
+    if (violations++ < 20) {
+        printf("after %s: id %u:", current, report->data[0]);
+        for (int i = 0; i < count; i++) {
+            printf(" %s=%d", decoder.field(layout->first + bad[i])->name, values[bad[i]]);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    uint32_t iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+    uint32_t seed = argc > 2 ? strtoul(argv[2], NULL, 0) : 1;
+    std::mt19937 rng(seed);
+    auto rand = [&rng](uint32_t n) { return (uint32_t) (rng() % n); };
+
+    USBKeyboardGamepad gamepad(false);
+    uint16_t length;
+    const uint8_t *desc = gamepad.host_report_desc(&length);
+    if (!decoder.parse(desc, length)) {
+        printf("report descriptor: %s\n", decoder.error());
+        return 1;
+    }
+    USBHID::host_report_hook = check;
+
+    RemapProfile profiles[2];
+    int chords[CHORD_MAX];
+    for (int i = 0; i < CHORD_MAX; i++) {
+        chords[i] = -1;
+    }
+    uint32_t unbalanced = 0;
+
+    for (uint32_t n = 0; n < iterations; n++) {
+        switch (rand(40)) {
+            case 0:
+            case 1:
+            case 2:
+                current = "SetButton";
+                gamepad.SetButton(rand(130) - 1, rand(2));
+                break;
+            case 3:
+            case 4: {
+                current = "axis setter";
+                uint16_t value = rng();
+                switch (rand(8)) {
+                    case 0:
+                        gamepad.SetX(value);
+                        break;
+                    case 1:
+                        gamepad.SetY(value);
+                        break;
+                    case 2:
+                        gamepad.SetZ(value);
+                        break;
+                    case 3:
+                        gamepad.SetRx(value);
+                        break;
+                    case 4:
+                        gamepad.SetRy(value);
+                        break;
+                    case 5:
+                        gamepad.SetRz(value);
+                        break;
+                    case 6:
+                        gamepad.SetS0(value);
+                        break;
+                    default:
+                        gamepad.SetThrottle(value);
+                        break;
+                }
+                break;
+            }
+            case 5:
+                current = "SetHat";
+                gamepad.SetHat(rand(4), rand(9));
+                break;
+            case 6:
+                current = "SetAnalogButton";
+                gamepad.SetAnalogButton(rand(ANALOG_BUTTONS + 1), rng());
+                break;
+            case 7: {
+                current = "ConfigureAnalogButton";
+                uint8_t release = rng();
+                gamepad.ConfigureAnalogButton(rand(ANALOG_BUTTONS + 1), rand(4) ? rand(128) : ANALOG_NO_BUTTON,
+                                              release + rand(256 - release), release, rand(3) ? 0 : rand(64));
+                break;
+            }
+            case 8:
+            case 9:
+            case 10:
+                current = "SendGamepadUpdates";
+                gamepad.SendGamepadUpdates();
+                break;
+            case 11:
+                current = "SetTurbo";
+                gamepad.SetTurbo(rand(TURBO_CHANNELS), rand(3) ? rand(100) : 0, rand(101));
+                break;
+            case 12: {
+                int slot = rand(CHORD_MAX);
+                if (chords[slot] >= 0) {
+                    current = "RemoveChord";
+                    gamepad.RemoveChord(chords[slot]);
+                    chords[slot] = -1;
+                    break;
+                }
+                current = "AddChord";
+                uint8_t buttons[3] = {(uint8_t) rand(128), (uint8_t) rand(128), (uint8_t) rand(128)};
+                CHORD_ACTION action = (CHORD_ACTION) rand(3);
+                uint16_t target = action == CHORD_BUTTON ? rand(128) : action == CHORD_KEY ? rand(256) : 1 + rand(0x3FF);
+                chords[slot] = gamepad.AddChord(buttons, 1 + rand(3), action, target, rng());
+                break;
+            }
+            case 13:
+                current = "SetInput";
+                gamepad.SetInput(rand(REMAP_INPUTS + 1), rand(2));
+                break;
+            case 14:
+                current = "SetInputAxis";
+                gamepad.SetInputAxis(rand(REMAP_AXES + 1), rng());
+                break;
+            case 15: {
+                current = "RemapProfile";
+                RemapProfile &profile = profiles[rand(2)];
+                uint8_t input = rand(REMAP_INPUTS);
+                switch (rand(8)) {
+                    case 0:
+                        profile.MapButton(input, rand(128));
+                        break;
+                    case 1:
+                        profile.MapKey(input, rng(), rng());
+                        break;
+                    case 2:
+                        profile.MapConsumer(input, 1 + rand(0x3FF));
+                        break;
+                    case 3:
+                        profile.MapButtonToAxis(input, rand(REMAP_AXIS_COUNT), rng());
+                        break;
+                    case 4:
+                        profile.Unmap(input);
+                        break;
+                    case 5:
+                        profile.MapAxis(rand(REMAP_AXES), rand(REMAP_AXIS_COUNT), rand(2));
+                        break;
+                    case 6:
+                        profile.MapAxisToButtons(rand(REMAP_AXES), -(int16_t) rand(32768), rand(128), rand(32768),
+                                                 rand(128));
+                        break;
+                    default:
+                        current = "SetRemapProfile";
+                        gamepad.SetRemapProfile(rand(3) ? &profiles[rand(2)] : NULL);
+                        break;
+                }
+                break;
+            }
+            case 16: {
+                current = "passthrough";
+                gamepad.SetPassthroughForward(rand(2));
+                HID_REPORT report;
+                report.length = 1 + GAMEPAD_STATE_SIZE;
+                report.data[0] = REPORT_ID_PASSTHROUGH;
+                for (int i = 1; i < (int) report.length; i++) {
+                    report.data[i] = rng();
+                }
+                gamepad.host_out(&report);
+                break;
+            }
+            case 17:
+                current = "MoveMouse";
+                gamepad.MoveMouse((int32_t) rand(2001) - 1000, (int32_t) rand(2001) - 1000);
+                break;
+            case 18:
+                current = "ScrollMouse";
+                gamepad.ScrollMouse((int32_t) rand(401) - 200, (int32_t) rand(401) - 200);
+                break;
+            case 19:
+                current = "SetMouseButton";
+                gamepad.SetMouseButton(rand(9), rand(2));
+                break;
+            case 20:
+                current = "SendMouseUpdates";
+                gamepad.SendMouseUpdates();
+                break;
+            case 21: {
+                current = "PushMotionSample";
+                int16_t accel[3] = {(int16_t) rng(), (int16_t) rng(), (int16_t) rng()};
+                int16_t gyro[3] = {(int16_t) rng(), (int16_t) rng(), (int16_t) rng()};
+                gamepad.PushMotionSample(rng(), accel, gyro);
+                break;
+            }
+            case 22:
+                current = "SendMotionUpdates";
+                gamepad.SendMotionUpdates();
+                break;
+            case 23:
+                current = "SendKeyCode";
+                gamepad.SendKeyCode(rng(), rng());
+                break;
+            case 24:
+            case 25:
+                current = "SetKey";
+                gamepad.SetKey(rng(), rand(2), rand(2) ? rng() : 0);
+                break;
+            case 26:
+                current = "SendKeyboardUpdates";
+                gamepad.SendKeyboardUpdates();
+                break;
+            case 27:
+                current = "BeginFrame";
+                gamepad.BeginFrame();
+                break;
+            case 28:
+                current = "CommitFrame";
+                gamepad.CommitFrame();
+                break;
+            case 29:
+                current = "media_control";
+                gamepad.media_control((MEDIA_KEY) rand(8));
+                break;
+            case 30:
+                current = "ConsumerPress";
+                gamepad.ConsumerPress(rand(0x400));
+                break;
+            case 31:
+                current = "ConsumerRelease";
+                gamepad.ConsumerRelease(rand(0x400));
+                break;
+            case 32:
+                current = "ConsumerReleaseAll";
+                gamepad.ConsumerReleaseAll();
+                break;
+            case 33:
+                current = "ConsumerTap";
+                gamepad.ConsumerTap(rand(0x400));
+                break;
+            case 34:
+                current = "putc";
+                gamepad.putc(rand(128));
+                break;
+            case 35:
+            case 36:
+                current = "engine tick";
+                mbed::Ticker::host_tick();
+                break;
+            case 37:
+            case 38:
+                current = "host poll";
+                gamepad.host_poll();
+                delay(1);
+                break;
+            default:
+                current = rand(2) ? "configure" : "unconfigure";
+                gamepad.host_configure(current[0] == 'c');
+                break;
+        }
+        if (core_util_in_critical_section()) {
+            // Every path must leave its critical sections
+            if (unbalanced++ < 20) {
+                printf("after %s: still in a critical section\n", current);
+            }
+            while (core_util_in_critical_section()) {
+                core_util_critical_section_exit();
+            }
+        }
+    }
+
+    printf("%u calls, %u reports (keyboard %u, consumer %u, gamepad %u, mouse %u, motion %u)\n",
+           iterations, reports, per_id[REPORT_ID_KEYBOARD], per_id[REPORT_ID_CONSUMER], per_id[REPORT_ID_GAMEPAD],
+           per_id[REPORT_ID_MOUSE], per_id[REPORT_ID_MOTION]);
+    printf("%u reports violate the descriptor, %u calls left a critical section open\n", violations, unbalanced);
+    return violations || unbalanced ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+// Host-side replayer for captures made with HIDReportRecorder.
+//
+// Build from the library root:
+//   c++ -O2 -I. extras/hid_replay.cpp HIDReportRecorder.cpp -o hid_replay
+//
+// Usage:
+//   hid_replay capture.bin                 print every report and per-ID timing
+//   hid_replay baseline.bin candidate.bin  compare report streams, exit 1 on mismatch
+
+#include "HIDReportRecorder.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace arduino;
+
+struct IdStats {
+    uint32_t count = 0;
+    uint32_t last = 0;
+    uint32_t min = UINT32_MAX;
+    uint32_t max = 0;
+    uint64_t total = 0;
+};
+
+static bool load(const char *path, std::vector<uint8_t> *data) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data->insert(data->end(), buf, buf + n);
+    }
+    fclose(f);
+    return true;
+}
+
+static bool decode(const char *path, std::vector<uint8_t> *raw, std::vector<HIDCaptureEntry> *entries) {
+    if (!load(path, raw)) {
+        return false;
+    }
+    HIDReportReplayer replayer;
+    if (!replayer.open(raw->data(), raw->size())) {
+        fprintf(stderr, "%s: not a capture\n", path);
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    HIDCaptureEntry entry;
+    while (replayer.next(&entry)) {
+        entries->push_back(entry);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    fprintf(stderr, "%s: %zu bytes, %zu reports (%u skipped), %.1f bytes/report, decoded at %.2f M reports/s\n",
+            path, raw->size(), entries->size(), replayer.skipped(),
+            entries->empty() ? 0.0 : (double) raw->size() / entries->size(),
+            seconds > 0 ? entries->size() / seconds / 1e6 : 0.0);
+    return true;
+}
+
+static void timing(const char *label, const std::vector<HIDCaptureEntry> &entries) {
+    IdStats stats[2][256];
+    for (const HIDCaptureEntry &e : entries) {
+        IdStats &s = stats[e.out][e.data[0]];
+        if (s.count > 0) {
+            uint32_t dt = e.timestamp - s.last;
+            s.min = dt < s.min ? dt : s.min;
+            s.max = dt > s.max ? dt : s.max;
+            s.total += dt;
+        }
+        s.last = e.timestamp;
+        s.count++;
+    }
+    for (int out = 0; out < 2; out++) {
+        for (int id = 0; id < 256; id++) {
+            const IdStats &s = stats[out][id];
+            if (s.count == 0) {
+                continue;
+            }
+            if (s.count == 1) {
+                printf("%s %s id %d: 1 report\n", label, out ? "OUT" : "IN ", id);
+                continue;
+            }
+            printf("%s %s id %d: %u reports, interval min %u avg %.1f max %u us\n",
+                   label, out ? "OUT" : "IN ", id, s.count, s.min,
+                   (double) s.total / (s.count - 1), s.max);
+        }
+    }
+}
+
+static void print(const HIDCaptureEntry &e, uint32_t origin) {
+    printf("%10u %s", e.timestamp - origin, e.out ? "OUT" : "IN ");
+    for (uint32_t i = 0; i < e.length; i++) {
+        printf(" %02x", e.data[i]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: %s capture.bin [candidate.bin]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<uint8_t> raw;
+    std::vector<HIDCaptureEntry> baseline;
+    if (!decode(argv[1], &raw, &baseline)) {
+        return 2;
+    }
+
+    if (argc == 2) {
+        uint32_t origin = baseline.empty() ? 0 : baseline[0].timestamp;
+        for (const HIDCaptureEntry &e : baseline) {
+            print(e, origin);
+        }
+        timing("", baseline);
+        return 0;
+    }
+
+    std::vector<uint8_t> candidate_raw;
+    std::vector<HIDCaptureEntry> candidate;
+    if (!decode(argv[2], &candidate_raw, &candidate)) {
+        return 2;
+    }
+
+    // Only the report payloads have to match, timing is reported side by side
+    size_t n = baseline.size() < candidate.size() ? baseline.size() : candidate.size();
+    for (size_t i = 0; i < n; i++) {
+        const HIDCaptureEntry &a = baseline[i];
+        const HIDCaptureEntry &b = candidate[i];
+        if (a.out != b.out || a.length != b.length || memcmp(a.data, b.data, a.length) != 0) {
+            printf("reports diverge at #%zu\n", i);
+            print(a, baseline[0].timestamp);
+            print(b, candidate[0].timestamp);
+            return 1;
+        }
+    }
+    timing("baseline ", baseline);
+    timing("candidate", candidate);
+    if (baseline.size() != candidate.size()) {
+        printf("report count differs: %zu vs %zu\n", baseline.size(), candidate.size());
+        return 1;
+    }
+    printf("%zu reports match\n", n);
+    return 0;
+}
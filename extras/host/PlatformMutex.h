@@ -0,0 +1,12 @@
+#ifndef HOST_PLATFORMMUTEX_H
+#define HOST_PLATFORMMUTEX_H
+
+// The host driver is single threaded
+class PlatformMutex {
+public:
+    void lock() {}
+
+    void unlock() {}
+};
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef HOST_PLUGGABLEUSBHID_H
+#define HOST_PLUGGABLEUSBHID_H
+
+// Host stand-in for the ArduinoCore-mbed USBHID, just enough for USBKeyboardGamepad.cpp to link
+// on a PC. A single IN endpoint buffer: send_nb() fails while a report is in flight, host_poll()
+// completes the transfer the way the host's interrupt poll would and calls report_tx().
+
+#include <assert.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "usb_phy_api.h"
+
+#define MAX_HID_REPORT_SIZE 64
+
+typedef struct {
+    uint32_t length;
+    uint8_t data[MAX_HID_REPORT_SIZE];
+} HID_REPORT;
+
+#define LSB(n) ((n) & 0xff)
+#define MSB(n) (((n) & 0xff00) >> 8)
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+// Report descriptor items
+#define USAGE_PAGE(s) (0x04 | (s))
+#define USAGE(s) (0x08 | (s))
+#define COLLECTION(s) (0xa0 | (s))
+#define END_COLLECTION(s) (0xc0 | (s))
+#define REPORT_ID(s) (0x84 | (s))
+#define USAGE_MINIMUM(s) (0x18 | (s))
+#define USAGE_MAXIMUM(s) (0x28 | (s))
+#define LOGICAL_MINIMUM(s) (0x14 | (s))
+#define LOGICAL_MAXIMUM(s) (0x24 | (s))
+#define PHYSICAL_MINIMUM(s) (0x34 | (s))
+#define PHYSICAL_MAXIMUM(s) (0x44 | (s))
+#define UNIT_EXPONENT(s) (0x54 | (s))
+#define UNIT(s) (0x64 | (s))
+#define REPORT_SIZE(s) (0x74 | (s))
+#define REPORT_COUNT(s) (0x94 | (s))
+#define PUSH(s) (0xa4 | (s))
+#define POP(s) (0xb4 | (s))
+#define INPUT(s) (0x80 | (s))
+#define OUTPUT(s) (0x90 | (s))
+#define FEATURE(s) (0xb0 | (s))
+
+// Requests
+#define STANDARD_TYPE 0
+#define CLASS_TYPE 1
+#define GET_REPORT 0x01
+#define GET_IDLE 0x02
+#define GET_PROTOCOL 0x03
+#define SET_REPORT 0x09
+#define SET_IDLE 0x0a
+#define SET_PROTOCOL 0x0b
+
+// Configuration descriptor
+#define CONFIGURATION_DESCRIPTOR_LENGTH 9
+#define INTERFACE_DESCRIPTOR_LENGTH 9
+#define HID_DESCRIPTOR_LENGTH 9
+#define ENDPOINT_DESCRIPTOR_LENGTH 7
+#define CONFIGURATION_DESCRIPTOR 2
+#define INTERFACE_DESCRIPTOR 4
+#define ENDPOINT_DESCRIPTOR 5
+#define HID_DESCRIPTOR 0x21
+#define REPORT_DESCRIPTOR 0x22
+#define C_RESERVED (1U << 7)
+#define C_SELF_POWERED (1U << 6)
+#define C_REMOTE_WAKEUP (1U << 5)
+#define C_POWER(x) ((x) / 2)
+#define HID_CLASS 3
+#define HID_SUBCLASS_NONE 0
+#define HID_SUBCLASS_BOOT 1
+#define HID_PROTOCOL_NONE 0
+#define HID_PROTOCOL_KEYBOARD 1
+#define HID_PROTOCOL_MOUSE 2
+#define HID_VERSION_1_11 0x0111
+#define E_INTERRUPT 3
+
+#define MBED_ASSERT(expr) assert(expr)
+
+typedef uint8_t usb_ep_t;
+
+uint32_t millis();
+uint32_t micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+class USBDevice {
+public:
+    enum DeviceState {
+        Attached,
+        Powered,
+        Default,
+        Address,
+        Configured,
+    };
+
+    enum RequestResult {
+        Receive = 0,
+        Send = 1,
+        Success = 2,
+        Failure = 3,
+        PassThrough = 4,
+    };
+
+    struct setup_packet_t {
+        struct {
+            uint8_t dataTransferDirection;
+            uint8_t Type;
+            uint8_t Recipient;
+        } bmRequestType;
+        uint8_t bRequest;
+        uint16_t wValue;
+        uint16_t wIndex;
+        uint16_t wLength;
+    };
+};
+
+class USBHID {
+public:
+    USBHID(USBPhy *phy, uint8_t output_report_length, uint8_t input_report_length, uint16_t vendor_id,
+           uint16_t product_id, uint16_t product_release);
+
+    virtual ~USBHID();
+
+    bool ready();
+
+    void wait_ready();
+
+    bool send(const HID_REPORT *report);
+
+    bool send_nb(const HID_REPORT *report);
+
+    bool read(HID_REPORT *report);
+
+    bool read_nb(HID_REPORT *report);
+
+    /* Host side: enumerate (or drop) the device, calls callback_state_change() */
+    void host_configure(bool configured);
+
+    /*
+    * Host side: take the report in flight, if any, hand it to host_report_hook and complete the
+    * transfer with report_tx()
+    */
+    bool host_poll(HID_REPORT *report = NULL);
+
+    /* Host side: deliver an OUT report through report_rx() */
+    void host_out(const HID_REPORT *report);
+
+    /* Host side: answer a control request, returns the data stage length */
+    uint32_t host_request(const USBDevice::setup_packet_t *setup, USBDevice::RequestResult *result, uint8_t **data);
+
+    const uint8_t *host_report_desc(uint16_t *length);
+
+    /* Called by yield(), so blocking sends see the host poll */
+    static void host_yield();
+
+    /* Sees every report the device sends, in order */
+    static void (*host_report_hook)(const HID_REPORT *report);
+
+protected:
+    virtual const uint8_t *report_desc();
+
+    uint16_t report_desc_length();
+
+    virtual void report_rx();
+
+    virtual void report_tx();
+
+    virtual const uint8_t *configuration_desc(uint8_t index);
+
+    virtual void callback_state_change(USBDevice::DeviceState new_state);
+
+    virtual uint32_t callback_request(const USBDevice::setup_packet_t *setup, USBDevice::RequestResult *result,
+                                      uint8_t **data);
+
+    virtual bool callback_request_xfer_done(const USBDevice::setup_packet_t *setup, bool aborted);
+
+    virtual bool callback_set_configuration(uint8_t configuration);
+
+    void assert_locked();
+
+    uint16_t reportLength;
+    usb_ep_t _int_in;
+    usb_ep_t _int_out;
+
+private:
+    static USBHID *_host_device;
+
+    bool _configured;
+    bool _in_flight;
+    HID_REPORT _input;
+    bool _output_valid;
+    HID_REPORT _output;
+};
+
+#endif
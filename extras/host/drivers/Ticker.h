@@ -0,0 +1,29 @@
+#ifndef HOST_TICKER_H
+#define HOST_TICKER_H
+
+#include <chrono>
+
+#include "platform/Callback.h"
+
+namespace mbed {
+
+    // Never fires on its own, host_tick() runs every attached callback once
+    class Ticker {
+    public:
+        Ticker();
+
+        ~Ticker();
+
+        void attach(Callback<void()> func, std::chrono::microseconds interval);
+
+        void detach();
+
+        static void host_tick();
+
+    private:
+        Callback<void()> _func;
+        Ticker *_next;
+    };
+}
+
+#endif
@@ -0,0 +1,250 @@
+#include "PluggableUSBHID.h"
+#include "platform/mbed_critical.h"
+#include "drivers/Ticker.h"
+
+#include <assert.h>
+
+// Simulated clock, only moves when the library waits
+static uint64_t host_time_us;
+static int critical_depth;
+
+uint32_t millis() {
+    return (uint32_t) (host_time_us / 1000);
+}
+
+uint32_t micros() {
+    return (uint32_t) host_time_us;
+}
+
+void delay(unsigned long ms) {
+    host_time_us += ms * 1000ull;
+}
+
+void delayMicroseconds(unsigned int us) {
+    host_time_us += us;
+}
+
+void yield() {
+    // A busy wait on the device is a host poll later
+    host_time_us += 125;
+    USBHID::host_yield();
+}
+
+void core_util_critical_section_enter() {
+    critical_depth++;
+}
+
+void core_util_critical_section_exit() {
+    assert(critical_depth > 0);
+    critical_depth--;
+}
+
+bool core_util_in_critical_section() {
+    return critical_depth > 0;
+}
+
+USBPhy *get_usb_phy() {
+    static USBPhy phy;
+    return &phy;
+}
+
+USBHID *USBHID::_host_device;
+void (*USBHID::host_report_hook)(const HID_REPORT *report);
+
+USBHID::USBHID(USBPhy *phy, uint8_t output_report_length, uint8_t input_report_length, uint16_t vendor_id,
+               uint16_t product_id, uint16_t product_release) {
+    (void) phy;
+    (void) output_report_length;
+    (void) input_report_length;
+    (void) vendor_id;
+    (void) product_id;
+    (void) product_release;
+    reportLength = 0;
+    _int_in = 0x81;
+    _int_out = 0x01;
+    _configured = false;
+    _in_flight = false;
+    _output_valid = false;
+    _host_device = this;
+}
+
+USBHID::~USBHID() {
+    if (_host_device == this) {
+        _host_device = NULL;
+    }
+}
+
+bool USBHID::ready() {
+    return _configured;
+}
+
+void USBHID::wait_ready() {
+    // Nothing would ever configure the device while we block, so configure it now
+    if (!_configured) {
+        host_configure(true);
+    }
+}
+
+bool USBHID::send(const HID_REPORT *report) {
+    while (!send_nb(report)) {
+        if (!_configured) {
+            return false;
+        }
+        yield();
+    }
+    return true;
+}
+
+bool USBHID::send_nb(const HID_REPORT *report) {
+    if (!_configured || _in_flight || report->length > MAX_HID_REPORT_SIZE) {
+        return false;
+    }
+    _input = *report;
+    _in_flight = true;
+    return true;
+}
+
+bool USBHID::read(HID_REPORT *report) {
+    return read_nb(report);
+}
+
+bool USBHID::read_nb(HID_REPORT *report) {
+    if (!_output_valid) {
+        report->length = 0;
+        return false;
+    }
+    *report = _output;
+    _output_valid = false;
+    return true;
+}
+
+void USBHID::host_configure(bool configured) {
+    _configured = configured;
+    _in_flight = false;
+    callback_state_change(configured ? USBDevice::Configured : USBDevice::Default);
+}
+
+bool USBHID::host_poll(HID_REPORT *report) {
+    if (!_in_flight) {
+        return false;
+    }
+    HID_REPORT sent = _input;
+    _in_flight = false;
+    if (report) {
+        *report = sent;
+    }
+    if (host_report_hook) {
+        host_report_hook(&sent);
+    }
+    report_tx();
+    return true;
+}
+
+void USBHID::host_out(const HID_REPORT *report) {
+    _output = *report;
+    _output_valid = true;
+    report_rx();
+}
+
+uint32_t USBHID::host_request(const USBDevice::setup_packet_t *setup, USBDevice::RequestResult *result,
+                              uint8_t **data) {
+    return callback_request(setup, result, data);
+}
+
+const uint8_t *USBHID::host_report_desc(uint16_t *length) {
+    const uint8_t *desc = report_desc();
+    *length = reportLength;
+    return desc;
+}
+
+void USBHID::host_yield() {
+    if (_host_device) {
+        _host_device->host_poll();
+    }
+}
+
+const uint8_t *USBHID::report_desc() {
+    reportLength = 0;
+    return NULL;
+}
+
+uint16_t USBHID::report_desc_length() {
+    report_desc();
+    return reportLength;
+}
+
+void USBHID::report_rx() {
+}
+
+void USBHID::report_tx() {
+}
+
+const uint8_t *USBHID::configuration_desc(uint8_t index) {
+    (void) index;
+    return NULL;
+}
+
+void USBHID::callback_state_change(USBDevice::DeviceState new_state) {
+    (void) new_state;
+}
+
+uint32_t USBHID::callback_request(const USBDevice::setup_packet_t *setup, USBDevice::RequestResult *result,
+                                  uint8_t **data) {
+    (void) setup;
+    (void) data;
+    *result = USBDevice::PassThrough;
+    return 0;
+}
+
+bool USBHID::callback_request_xfer_done(const USBDevice::setup_packet_t *setup, bool aborted) {
+    (void) setup;
+    (void) aborted;
+    return true;
+}
+
+bool USBHID::callback_set_configuration(uint8_t configuration) {
+    (void) configuration;
+    return true;
+}
+
+void USBHID::assert_locked() {
+}
+
+namespace mbed {
+
+    static Ticker *tickers;
+
+    Ticker::Ticker() {
+        _next = tickers;
+        tickers = this;
+    }
+
+    Ticker::~Ticker() {
+        for (Ticker **t = &tickers; *t; t = &(*t)->_next) {
+            if (*t == this) {
+                *t = _next;
+                break;
+            }
+        }
+    }
+
+    void Ticker::attach(Callback<void()> func, std::chrono::microseconds interval) {
+        (void) interval;
+        _func = func;
+    }
+
+    void Ticker::detach() {
+        _func = nullptr;
+    }
+
+    void Ticker::host_tick() {
+        // The ticker is an interrupt
+        for (Ticker *t = tickers; t; t = t->_next) {
+            if (t->_func) {
+                core_util_critical_section_enter();
+                t->_func();
+                core_util_critical_section_exit();
+            }
+        }
+    }
+}
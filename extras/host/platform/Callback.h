@@ -0,0 +1,40 @@
+#ifndef HOST_CALLBACK_H
+#define HOST_CALLBACK_H
+
+#include <cstddef>
+#include <functional>
+
+namespace mbed {
+
+    template<typename F>
+    class Callback;
+
+    template<typename R, typename... Args>
+    class Callback<R(Args...)> {
+    public:
+        Callback() {}
+
+        Callback(std::nullptr_t) {}
+
+        template<typename F>
+        Callback(F f) : _f(f) {}
+
+        R operator()(Args... args) const {
+            return _f(args...);
+        }
+
+        explicit operator bool() const {
+            return (bool) _f;
+        }
+
+    private:
+        std::function<R(Args...)> _f;
+    };
+
+    template<typename T, typename U, typename R, typename... Args>
+    Callback<R(Args...)> callback(U *obj, R (T::*method)(Args...)) {
+        return Callback<R(Args...)>([obj, method](Args... args) { return (obj->*method)(args...); });
+    }
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef HOST_STREAM_H
+#define HOST_STREAM_H
+
+#include <stdarg.h>
+#include <stdio.h>
+
+namespace mbed {
+
+    class Stream {
+    public:
+        virtual ~Stream() {}
+
+        int putc(int c) {
+            return _putc(c);
+        }
+
+        int printf(const char *format, ...) {
+            char buffer[256];
+            va_list args;
+            va_start(args, format);
+            int length = vsnprintf(buffer, sizeof(buffer), format, args);
+            va_end(args);
+            for (int i = 0; i < length && i < (int) sizeof(buffer) - 1; i++) {
+                _putc(buffer[i]);
+            }
+            return length;
+        }
+
+    protected:
+        virtual int _putc(int c) = 0;
+
+        virtual int _getc() = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef HOST_MBED_ATOMIC_H
+#define HOST_MBED_ATOMIC_H
+
+#include <stdint.h>
+
+// Single threaded host, plain loads and stores are atomic enough
+
+inline uint8_t core_util_atomic_fetch_or_u8(volatile uint8_t *ptr, uint8_t arg) {
+    uint8_t old = *ptr;
+    *ptr = old | arg;
+    return old;
+}
+
+inline uint8_t core_util_atomic_fetch_and_u8(volatile uint8_t *ptr, uint8_t arg) {
+    uint8_t old = *ptr;
+    *ptr = old & arg;
+    return old;
+}
+
+inline uint16_t core_util_atomic_load_u16(const volatile uint16_t *ptr) {
+    return *ptr;
+}
+
+inline void core_util_atomic_store_u16(volatile uint16_t *ptr, uint16_t value) {
+    *ptr = value;
+}
+
+inline uint32_t core_util_atomic_load_u32(const volatile uint32_t *ptr) {
+    return *ptr;
+}
+
+inline void core_util_atomic_store_u32(volatile uint32_t *ptr, uint32_t value) {
+    *ptr = value;
+}
+
+inline uint32_t core_util_atomic_fetch_add_u32(volatile uint32_t *ptr, uint32_t arg) {
+    uint32_t old = *ptr;
+    *ptr = old + arg;
+    return old;
+}
+
+inline uint32_t core_util_atomic_fetch_sub_u32(volatile uint32_t *ptr, uint32_t arg) {
+    uint32_t old = *ptr;
+    *ptr = old - arg;
+    return old;
+}
+
+inline int32_t core_util_atomic_load_s32(const volatile int32_t *ptr) {
+    return *ptr;
+}
+
+inline int32_t core_util_atomic_fetch_add_s32(volatile int32_t *ptr, int32_t arg) {
+    int32_t old = *ptr;
+    *ptr = old + arg;
+    return old;
+}
+
+inline void *core_util_atomic_load_ptr(void *const volatile *ptr) {
+    return *ptr;
+}
+
+inline void core_util_atomic_store_ptr(void *volatile *ptr, void *value) {
+    *ptr = value;
+}
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef HOST_MBED_CRITICAL_H
+#define HOST_MBED_CRITICAL_H
+
+#include <stdbool.h>
+
+// Nesting is tracked so the driver can check that every enter has its exit
+void core_util_critical_section_enter();
+
+void core_util_critical_section_exit();
+
+bool core_util_in_critical_section();
+
+#endif
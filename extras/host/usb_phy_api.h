@@ -0,0 +1,11 @@
+#ifndef HOST_USB_PHY_API_H
+#define HOST_USB_PHY_API_H
+
+class USBPhy {
+public:
+    virtual ~USBPhy() {}
+};
+
+USBPhy *get_usb_phy();
+
+#endif
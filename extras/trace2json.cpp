@@ -0,0 +1,100 @@
+// Converts trace_dump() output into a Chrome trace (chrome://tracing, ui.perfetto.dev).
+//
+// Build from the library root:
+//   c++ -O2 extras/trace2json.cpp -o trace2json
+//
+// Usage:
+//   trace2json [--hz cycles_per_second] < dump.txt > trace.json
+//
+// --hz is only needed when the dump says hz=0, e.g. for rdtsc on a host build.
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct Stat {
+    std::string name;
+    unsigned long count, min, avg, max;
+};
+
+struct Event {
+    std::string name;
+    unsigned long start, cycles;
+    int isr;
+    long long ts; // unwrapped start
+};
+
+int main(int argc, char **argv) {
+    double hz = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--hz") == 0 && i + 1 < argc) {
+            hz = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--hz cycles_per_second] < dump > trace.json\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<Stat> stats;
+    std::vector<Event> events;
+    char line[256];
+    char name[64];
+    while (fgets(line, sizeof(line), stdin)) {
+        unsigned long a, b, c, d;
+        if (strncmp(line, "# usbkg-trace", 13) == 0) {
+            const char *dump_hz = strstr(line, "hz=");
+            if (dump_hz && hz == 0) {
+                hz = atof(dump_hz + 3);
+            }
+        } else if (sscanf(line, "S %63s %lu %lu %lu %lu", name, &a, &b, &c, &d) == 5) {
+            stats.push_back({name, a, b, c, d});
+        } else {
+            int isr = 0;
+            if (sscanf(line, "E %63s %lu %lu %d", name, &a, &b, &isr) >= 3) {
+                events.push_back({name, a, b, isr, 0});
+            }
+        }
+    }
+    if (hz <= 0) {
+        fprintf(stderr, "cycle frequency unknown, pass --hz\n");
+        return 2;
+    }
+
+    // The counter is 32 bits. Events are in end order, so an interrupt that finished inside a long
+    // call starts later than the call that follows it; only a step of more than half the range
+    // backwards is a wrap.
+    double scale = 1e6 / hz;
+    long long origin = 0;
+    for (size_t i = 0; i < events.size(); i++) {
+        Event &e = events[i];
+        e.ts = i == 0 ? (long long) e.start
+                      : events[i - 1].ts + (int32_t) (uint32_t) (e.start - events[i - 1].start);
+        origin = i == 0 || e.ts < origin ? e.ts : origin;
+    }
+    std::stable_sort(events.begin(), events.end(), [](const Event &x, const Event &y) { return x.ts < y.ts; });
+
+    // Interrupt context on its own track, it does not nest inside whatever it interrupted
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    printf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"thread\"}},\n");
+    printf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"interrupt\"}}");
+    for (size_t i = 0; i < events.size(); i++) {
+        const Event &e = events[i];
+        double ts = (e.ts - origin) * scale;
+        printf(",\n{\"name\":\"%s\",\"cat\":\"usbkg\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+               "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"cycles\":%lu}}",
+               e.name.c_str(), e.isr ? 2 : 1, ts, e.cycles * scale, e.cycles);
+    }
+    printf("\n");
+    printf("],\"otherData\":{\"hz\":%.0f", hz);
+    for (const Stat &s : stats) {
+        printf(",\"%s\":\"count %lu min %lu avg %lu max %lu cycles\"", s.name.c_str(), s.count, s.min, s.avg,
+               s.max);
+        fprintf(stderr, "%-20s count %8lu  min %8lu  avg %8lu  max %8lu cycles\n", s.name.c_str(), s.count, s.min,
+                s.avg, s.max);
+    }
+    printf("}}\n");
+    return 0;
+}